@@ -0,0 +1,635 @@
+/**
+ * @file bench.cxx
+ * definition of g4db-bench executable
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/version.hpp>
+
+#include "G4DarkBreM/CMScaling.h"
+#include "G4DarkBreM/ElementXsecCache.h"
+#include "G4DarkBreM/EventLibrary.h"
+#include "G4DarkBreM/G4APrime.h"
+#include "G4DarkBreM/G4DarkBreMModel.h"
+#include "G4DarkBreM/ParseLibrary.h"
+
+#include "G4SystemOfUnits.hh"
+#include "G4Version.hh"
+#include "Randomize.hh"
+
+#ifndef G4DARKBREM_DATA_DIR
+/// directory holding the example libraries, defined by CMake
+#define G4DARKBREM_DATA_DIR "data"
+#endif
+
+namespace g4db {
+
+/**
+ * benchmarks of G4DarkBreM hot paths
+ *
+ * Each benchmark is a Case which is timed by running it several times
+ * and keeping the fastest run. The setup for a case (e.g. writing
+ * an input file) is done when the case is created and is not timed.
+ */
+namespace bench {
+
+/**
+ * A single benchmark case
+ */
+struct Case {
+  /// name of the case, used to select it on the command line
+  std::string name;
+  /// number of bytes processed by one run, zero if not meaningful
+  double bytes;
+  /// run the case once, returning the number of items processed
+  std::function<std::size_t()> run;
+};
+
+/**
+ * Configuration shared by all of the benchmarks
+ */
+struct Config {
+  /// directory holding the example libraries
+  std::string data_dir{G4DARKBREM_DATA_DIR};
+  /// scratch directory for files written during setup
+  std::string scratch_dir;
+  /// files written to the scratch directory, removed at the end
+  std::vector<std::string> scratch_files;
+  /// number of times to run each case
+  int repeat{3};
+
+  /// remove the scratch files and directory
+  ~Config() {
+    for (const auto& f : scratch_files) std::remove(f.c_str());
+    if (not scratch_dir.empty()) rmdir(scratch_dir.c_str());
+  }
+};
+
+/// electron example library in the data directory
+static const std::string ELECTRON_LIBRARY{"electron_tungsten_MaxE_4.0_MinE_0.2_RelEStep_0.1_UndecayedAP_mA_0.1_run_3000.csv.gz"};
+
+/// muon example library in the data directory
+static const std::string MUON_LIBRARY{"muon_copper_MaxE_100.0_MinE_2.0_RelEStep_0.1_UndecayedAP_mA_1.0_run_3000.csv.gz"};
+
+/**
+ * Get the size of a file in bytes
+ *
+ * @param[in] path path to file
+ * @return size in bytes
+ */
+double fileSize(const std::string& path) {
+  std::ifstream f{path, std::ios::binary | std::ios::ate};
+  if (not f.is_open()) throw std::runtime_error("Unable to open '"+path+"'.");
+  return f.tellg();
+}
+
+/**
+ * Decompress a gzip-compressed file
+ *
+ * @param[in] src path to compressed file
+ * @param[in] dest path to write decompressed file to
+ */
+void gunzip(const std::string& src, const std::string& dest) {
+  boost::iostreams::filtering_istream in;
+  in.push(boost::iostreams::gzip_decompressor());
+  in.push(boost::iostreams::file_source(src, std::ios::binary));
+  std::ofstream out{dest, std::ios::binary};
+  if (not out.is_open()) throw std::runtime_error("Unable to open '"+dest+"' for writing.");
+  boost::iostreams::copy(in, out);
+}
+
+/**
+ * Count the events in a library
+ *
+ * @param[in] lib library to count
+ * @return number of events in it
+ */
+std::size_t numEvents(const std::map<double, std::vector<OutgoingKinematics>>& lib) {
+  std::size_t n{0};
+  for (const auto& e : lib) n += e.second.size();
+  return n;
+}
+
+/**
+ * Write a library as an LHE file
+ *
+ * Only the lines that parse::lhe looks at are written with realistic content,
+ * the other lines are filler that matches the layout of MadGraph/MadEvent output.
+ * The A' four-momentum is recovered from the center-of-momentum and the recoil.
+ *
+ * Since LHE files are large, only the first `max_per_energy` events
+ * of each incident energy are written.
+ *
+ * @param[in] path path to file to write
+ * @param[in] lib library to write
+ * @param[in] max_per_energy maximum number of events to write for each energy
+ */
+void writeLHE(const std::string& path, const std::map<double, std::vector<OutgoingKinematics>>& lib,
+    std::size_t max_per_energy) {
+  std::FILE* f = std::fopen(path.c_str(), "w");
+  if (not f) throw std::runtime_error("Unable to open '"+path+"' for writing.");
+  std::fprintf(f, "<LesHouchesEvents version=\"1.0\">\n<header>\n</header>\n");
+  for (const auto& lib_entry : lib) {
+    for (std::size_t i{0}; i < lib_entry.second.size() and i < max_per_energy; i++) {
+      const OutgoingKinematics& ok{lib_entry.second[i]};
+      std::fprintf(f, "<event>\n 5      0 +1.0000000e+00 1.00000000e+03 7.54677100e-03 1.19004900e-01\n");
+      std::fprintf(f, " %8d -1    0    0    0    0 +0.0000000000e+00 +0.0000000000e+00 %+.10e %.10e %.10e 0.0000e+00 1.0000e+00\n",
+          11, lib_entry.first, lib_entry.first, 5.11e-4);
+      std::fprintf(f, " %8d -1    0    0    0    0 +0.0000000000e+00 +0.0000000000e+00 +0.0000000000e+00 %.10e %.10e 0.0000e+00 0.0000e+00\n",
+          623, 171.3, 171.3);
+      std::fprintf(f, " %8d  1    1    2    0    0 %+.10e %+.10e %+.10e %.10e %.10e 0.0000e+00 1.0000e+00\n",
+          11, ok.lepton.px(), ok.lepton.py(), ok.lepton.pz(), ok.lepton.e(), 5.11e-4);
+      std::fprintf(f, " %8d  1    1    2    0    0 +0.0000000000e+00 +0.0000000000e+00 +0.0000000000e+00 %.10e %.10e 0.0000e+00 0.0000e+00\n",
+          623, 171.3, 171.3);
+      std::fprintf(f, " %8d  1    1    2    0    0 %+.10e %+.10e %+.10e %.10e %.10e 0.0000e+00 0.0000e+00\n",
+          622, ok.centerMomentum.px() - ok.lepton.px(), ok.centerMomentum.py() - ok.lepton.py(),
+          ok.centerMomentum.pz() - ok.lepton.pz(), ok.centerMomentum.e() - ok.lepton.e(), 0.1);
+      std::fprintf(f, "</event>\n");
+    }
+  }
+  std::fprintf(f, "</LesHouchesEvents>\n");
+  std::fclose(f);
+}
+
+/**
+ * Benchmarks for parsing libraries
+ *
+ * The shipped libraries are gzip-compressed CSV, so we decompress them and
+ * write each of them out as an LHE file in the scratch directory in order
+ * to measure the parsing throughput of each of the formats. The throughput
+ * is always measured in bytes of decompressed text.
+ *
+ * @param[in] cfg configuration for benchmarks
+ * @param[in,out] cases list of cases to add to
+ */
+void parsing(Config& cfg, std::vector<Case>& cases) {
+  for (std::string lepton : {"electron", "muon"}) {
+    std::string csv_gz_path = cfg.data_dir + "/" + (lepton == "muon" ? MUON_LIBRARY : ELECTRON_LIBRARY);
+    std::string csv_path = cfg.scratch_dir + "/" + lepton + ".csv";
+    cfg.scratch_files.push_back(csv_path);
+    gunzip(csv_gz_path, csv_path);
+    double csv_size = fileSize(csv_path);
+    cases.push_back(Case{"parse-csv-"+lepton, csv_size, [csv_path]() {
+      std::map<double, std::vector<OutgoingKinematics>> l;
+      parseLibrary(csv_path, 622, l);
+      return numEvents(l);
+    }});
+    cases.push_back(Case{"parse-csv.gz-"+lepton, csv_size, [csv_gz_path]() {
+      std::map<double, std::vector<OutgoingKinematics>> l;
+      parseLibrary(csv_gz_path, 622, l);
+      return numEvents(l);
+    }});
+
+    std::map<double, std::vector<OutgoingKinematics>> lib;
+    parseLibrary(csv_path, 622, lib);
+    std::string lhe_path = cfg.scratch_dir + "/" + lepton + ".lhe";
+    cfg.scratch_files.push_back(lhe_path);
+    writeLHE(lhe_path, lib, 2000);
+    cases.push_back(Case{"parse-lhe-"+lepton, fileSize(lhe_path), [lhe_path]() {
+      std::map<double, std::vector<OutgoingKinematics>> l;
+      parseLibrary(lhe_path, 622, l);
+      return numEvents(l);
+    }});
+  }
+}
+
+/**
+ * Benchmarks for sampling from a library
+ *
+ * A fine-grained library (relative energy step of 1%) is built from the
+ * muon example library by copying the events of the closest energy above
+ * each fine-grained energy. We then look up the events for a fixed sequence
+ * of random incident energies using the std::map walk that G4DarkBreMModel
+ * used to do and using EventLibrary::findEnergy.
+ *
+ * @param[in] cfg configuration for benchmarks
+ * @param[in,out] cases list of cases to add to
+ */
+void sampling(Config& cfg, std::vector<Case>& cases) {
+  std::map<double, std::vector<OutgoingKinematics>> coarse;
+  parseLibrary(cfg.data_dir + "/" + MUON_LIBRARY, 622, coarse);
+  auto lib = std::make_shared<std::map<double, std::vector<OutgoingKinematics>>>();
+  double min_energy = coarse.begin()->first, max_energy = coarse.rbegin()->first;
+  for (double energy{min_energy}; energy < max_energy; energy *= 1.01) {
+    auto it = coarse.lower_bound(energy);
+    (*lib)[energy] = std::vector<OutgoingKinematics>(it->second.begin(),
+        it->second.begin() + std::min<std::size_t>(1000, it->second.size()));
+  }
+
+  auto incident = std::make_shared<std::vector<double>>(1000000);
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<double> uniform{min_energy, max_energy};
+  for (double& e : *incident) e = uniform(rng);
+
+  auto cursors = std::make_shared<std::map<double, unsigned int>>();
+  for (const auto& lib_entry : *lib) (*cursors)[lib_entry.first] = 0;
+  cases.push_back(Case{"sample-map-walk", 0., [lib, cursors, incident]() {
+    double sum{0.};
+    for (double incident_energy : *incident) {
+      double samplingE = 0.;
+      for (const auto& keyVal : *cursors) {
+        samplingE = keyVal.first;
+        if (incident_energy < samplingE) break;
+      }
+      if (cursors->at(samplingE) >= lib->at(samplingE).size()) (*cursors)[samplingE] = 0;
+      sum += lib->at(samplingE).at((*cursors)[samplingE]++).lepton.e();
+    }
+    return incident->size() + (sum < 0);
+  }});
+
+  auto compact = std::make_shared<EventLibrary>(*lib);
+  auto bins = std::make_shared<std::vector<unsigned int>>(compact->numEnergies(), 0);
+  cases.push_back(Case{"sample-binary-search", 0., [compact, bins, incident]() {
+    double sum{0.};
+    for (double incident_energy : *incident) {
+      std::size_t i_energy = compact->findEnergy(incident_energy);
+      unsigned int& cursor{(*bins)[i_energy]};
+      if (cursor >= compact->numEvents(i_energy)) cursor = 0;
+      sum += compact->at(i_energy, cursor++).lepton.e();
+    }
+    return incident->size() + (sum < 0);
+  }});
+}
+
+/**
+ * Benchmarks for the CMScaling method
+ *
+ * All of the events of one incident energy in the muon example library
+ * are scaled to a lower incident energy, once with the CLHEP Lorentz
+ * vectors used for each event in G4DarkBreMModel::scale before and
+ * once with the batch cmScaling kernel.
+ *
+ * @param[in] cfg configuration for benchmarks
+ * @param[in,out] cases list of cases to add to
+ */
+void scaling(Config& cfg, std::vector<Case>& cases) {
+  std::map<double, std::vector<OutgoingKinematics>> parsed;
+  parseLibrary(cfg.data_dir + "/" + MUON_LIBRARY, 622, parsed);
+  auto lib = std::make_shared<EventLibrary>(parsed);
+  const std::size_t i_energy = lib->findEnergy(50.);
+  const double sample_energy = lib->energies()[i_energy];
+  const double incident_energy = 0.9*sample_energy;
+  const double lepton_mass{0.10566}, aprime_mass{1.};
+  const double ke_ratio = (incident_energy - lepton_mass - aprime_mass)
+                          / (sample_energy - lepton_mass - aprime_mass);
+  // scale the events of this energy over and over for about a million vertices
+  const std::size_t n_events = lib->numEvents(i_energy);
+  const std::size_t n_passes = 1000000/n_events + 1;
+
+  cases.push_back(Case{"cm-scaling-clhep", 0., [=]() {
+    double sum{0.};
+    for (std::size_t i_pass{0}; i_pass < n_passes; i_pass++) {
+      for (std::size_t i_event{0}; i_event < n_events; i_event++) {
+        OutgoingKinematics data = lib->at(i_energy, i_event);
+        CLHEP::HepLorentzVector el(data.lepton.px(), data.lepton.py(), data.lepton.pz(),
+                                   data.lepton.e());
+        double ediff = data.E - incident_energy;
+        CLHEP::HepLorentzVector newcm(data.centerMomentum.px(), data.centerMomentum.py(),
+                                      data.centerMomentum.pz() - ediff,
+                                      data.centerMomentum.e() - ediff);
+        el.boost(-1. * data.centerMomentum.boostVector());
+        el.boost(newcm.boostVector());
+        double newE = (data.lepton.e() - lepton_mass) * ke_ratio + lepton_mass;
+        el.setE(newE);
+        sum += el.e() + el.perp() + el.vect().mag();
+      }
+    }
+    return n_passes*n_events + (sum < 0);
+  }});
+
+  cases.push_back(Case{"cm-scaling-kernel", 0., [=]() {
+    const double* columns[EventLibrary::NColumns];
+    for (int c{0}; c < EventLibrary::NColumns; c++) {
+      columns[c] = lib->column(EventLibrary::Column(c), i_energy);
+    }
+    std::vector<double> e_acc(n_events), pt(n_events), p(n_events);
+    double sum{0.};
+    for (std::size_t i_pass{0}; i_pass < n_passes; i_pass++) {
+      cmScaling(n_events, columns, sample_energy, incident_energy, lepton_mass, ke_ratio,
+                e_acc.data(), pt.data(), p.data());
+      sum += e_acc[i_pass % n_events] + pt[i_pass % n_events] + p[i_pass % n_events];
+    }
+    return n_passes*n_events + (sum < 0);
+  }});
+
+  /*
+   * each scaling method of the model for a fixed sequence of random
+   * incident energies, the random engine is reseeded for each run so
+   * every run scales the same vertices
+   */
+  auto scale_incident = std::make_shared<std::vector<double>>(100000);
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<double> uniform{lib->energies()[0], lib->energies()[lib->numEnergies()-1]};
+  for (double& e : *scale_incident) e = uniform(rng);
+  for (std::string method : {"forward_only", "cm_scaling", "undefined"}) {
+    auto model = std::make_shared<G4DarkBreMModel>(method, 0.0, 1.0,
+        cfg.data_dir + "/" + MUON_LIBRARY, true);
+    cases.push_back(Case{"scale-"+method, 0., [=]() {
+      G4Random::setTheSeed(42);
+      double sum{0.};
+      for (double e : *scale_incident) sum += model->scale(e, lepton_mass).mag();
+      return scale_incident->size() + (sum < 0);
+    }});
+  }
+}
+
+/**
+ * Benchmarks for calculating the cross section
+ *
+ * The cross section of a 1 GeV A' off of copper is calculated for
+ * a few muon energies spanning the example library, once with the
+ * nested adaptive integrals and once with the fixed quadrature rule.
+ * The electron cross section is calculated off of tungsten.
+ *
+ * Looking up cross sections that are already in the cache is
+ * compared to a std::map with the keys the cache used to have.
+ * Missing the cache is measured with a cache that is created for each
+ * run and is not shared with any other cache, so every lookup misses.
+ *
+ * @param[in] cfg configuration for benchmarks
+ * @param[in,out] cases list of cases to add to
+ */
+void crossSection(Config&, std::vector<Case>& cases) {
+  auto adaptive = std::make_shared<G4DarkBreMModel>("forward_only",
+        0.0, 1.0, "NOT NEEDED", true, 622, false);
+  adaptive->SetAdaptiveMuonIntegration(true);
+  auto fixed = std::make_shared<G4DarkBreMModel>("forward_only",
+        0.0, 1.0, "NOT NEEDED", true, 622, false);
+  const std::vector<double> energies{2.*GeV, 10.*GeV, 100.*GeV};
+
+  cases.push_back(Case{"muon-xsec-adaptive", 0., [=]() {
+    double sum{0.};
+    for (double e : energies) sum += adaptive->ComputeCrossSectionPerAtom(e, 63.546, 29.);
+    return energies.size() + (sum < 0);
+  }});
+
+  cases.push_back(Case{"muon-xsec-fixed", 0., [=]() {
+    double sum{0.};
+    for (double e : energies) sum += fixed->ComputeCrossSectionPerAtom(e, 63.546, 29.);
+    return energies.size() + (sum < 0);
+  }});
+
+  auto electron = std::make_shared<G4DarkBreMModel>("forward_only",
+        0.0, 1.0, "NOT NEEDED", false, 622, false);
+  const std::vector<double> electron_energies{3.*GeV, 4.*GeV, 8.*GeV};
+  cases.push_back(Case{"electron-xsec", 0., [=]() {
+    double sum{0.};
+    for (double e : electron_energies) sum += electron->ComputeCrossSectionPerAtom(e, 183.84, 74.);
+    return electron_energies.size() + (sum < 0);
+  }});
+
+  // a different epsilon so this cache doesn't share the entries of the other caches
+  auto missed = std::make_shared<G4DarkBreMModel>("forward_only",
+        0.0, 0.5, "NOT NEEDED", false, 622, false);
+  cases.push_back(Case{"xsec-cache-miss", 0., [=]() {
+    ElementXsecCache miss_cache(missed);
+    const std::size_t n_misses{100};
+    double sum{0.};
+    for (std::size_t i{0}; i < n_misses; i++) sum += miss_cache.get(3.*GeV + i, 183.84, 74.);
+    return n_misses + (sum < 0);
+  }});
+
+  /*
+   * look up cross sections that are already cached, once in a std::map
+   * keyed like the cache was before and once in the cache itself
+   */
+  auto cache = std::make_shared<ElementXsecCache>(fixed);
+  auto map = std::make_shared<std::map<unsigned long int, double>>();
+  const std::size_t n_energies{1000}, n_lookups{1000000};
+  for (std::size_t i{0}; i < n_energies; i++) {
+    double e = 2.*GeV + i;
+    for (double Z : {29., 74.}) {
+      double xsec = cache->get(e, 2.*Z, Z);
+      map->emplace((static_cast<unsigned long int>(Z)*1000
+                    + static_cast<unsigned long int>(2.*Z))*1500000
+                   + static_cast<unsigned long int>(e), xsec);
+    }
+  }
+
+  cases.push_back(Case{"xsec-cache-map", 0., [=]() {
+    double sum{0.};
+    for (std::size_t i{0}; i < n_lookups; i++) {
+      unsigned long int Z = (i % 2) ? 29 : 74;
+      unsigned long int key = (Z*1000 + 2*Z)*1500000 + 2000 + (i*7) % n_energies;
+      auto entry = map->find(key);
+      if (entry != map->end()) sum += map->at(key);
+    }
+    return n_lookups + (sum < 0);
+  }});
+
+  cases.push_back(Case{"xsec-cache-hit", 0., [=]() {
+    double sum{0.};
+    for (std::size_t i{0}; i < n_lookups; i++) {
+      double Z = (i % 2) ? 29. : 74.;
+      sum += cache->get(2.*GeV + (i*7) % n_energies, 2.*Z, Z);
+    }
+    return n_lookups + (sum < 0);
+  }});
+}
+
+/**
+ * Result of timing a case
+ */
+struct Result {
+  /// fastest time for one run [s]
+  double best;
+  /// mean time for one run [s]
+  double mean;
+  /// number of items processed in one run
+  std::size_t items;
+};
+
+/**
+ * Time a case, keeping the fastest and mean of the repeated runs
+ *
+ * @param[in] c case to time
+ * @param[in] repeat number of times to run the case
+ * @return timing of the case
+ */
+Result time(const Case& c, int repeat) {
+  Result r{-1., 0., 0};
+  for (int i{0}; i < repeat; i++) {
+    auto start = std::chrono::steady_clock::now();
+    r.items = c.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (r.best < 0 or elapsed.count() < r.best) r.best = elapsed.count();
+    r.mean += elapsed.count()/repeat;
+  }
+  return r;
+}
+
+}  // namespace bench
+}  // namespace g4db
+
+/**
+ * printout how to use g4db-bench
+ */
+void usage() {
+  std::cout <<
+    "USAGE:\n"
+    "  g4db-bench [options] [case ...]\n"
+    "\n"
+    "Run benchmarks of G4DarkBreM hot paths using the example libraries.\n"
+    "If no cases are given, all of them are run.\n"
+    "\n"
+    "OPTIONS\n"
+    "  -h,--help     : produce this help and exit\n"
+    "  -l,--list     : list the available cases and exit\n"
+    "  -d,--data-dir : directory holding the example libraries\n"
+    "                  defaults to the data directory of the source tree\n"
+    "  -r,--repeat   : number of times to run each case, the fastest is reported\n"
+    "  -f,--format   : format of results, 'table' (the default), 'csv', or 'json'\n"
+    "                  the csv and json formats hold the same results and include\n"
+    "                  the Geant4 and Boost versions so they can be tracked over time\n"
+    "  -o,--output   : file to write results to (defaults to the terminal)\n"
+    << std::flush;
+}
+
+/**
+ * definition of g4db-bench
+ */
+int main(int argc, char* argv[]) try {
+  g4db::bench::Config cfg;
+  bool list{false};
+  std::string format{"table"};
+  std::string output;
+  std::vector<std::string> selected;
+  for (int i_arg{1}; i_arg < argc; i_arg++) {
+    std::string arg{argv[i_arg]};
+    if (arg == "-h" or arg == "--help") {
+      usage();
+      return 0;
+    } else if (arg == "-l" or arg == "--list") {
+      list = true;
+    } else if (arg == "-d" or arg == "--data-dir") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      cfg.data_dir = argv[++i_arg];
+    } else if (arg == "-r" or arg == "--repeat") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      cfg.repeat = std::stoi(argv[++i_arg]);
+      if (cfg.repeat < 1) {
+        std::cerr << arg << " must be at least one" << std::endl;
+        return 1;
+      }
+    } else if (arg == "-f" or arg == "--format") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      format = argv[++i_arg];
+      if (format != "table" and format != "csv" and format != "json") {
+        std::cerr << arg << " must be 'table', 'csv', or 'json'" << std::endl;
+        return 1;
+      }
+    } else if (arg == "-o" or arg == "--output") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      output = argv[++i_arg];
+    } else if (not arg.empty() and arg[0] == '-') {
+      std::cerr << arg << " is not a recognized option" << std::endl;
+      return 1;
+    } else {
+      selected.push_back(arg);
+    }
+  }
+
+  char scratch_template[] = "/tmp/g4db-bench-XXXXXX";
+  if (not mkdtemp(scratch_template)) {
+    std::cerr << "ERROR: Unable to create scratch directory." << std::endl;
+    return 2;
+  }
+  cfg.scratch_dir = scratch_template;
+
+  // the muon example library and all of the cross sections are for a 1 GeV A'
+  G4APrime::Initialize(1.*GeV);
+
+  std::vector<g4db::bench::Case> cases;
+  g4db::bench::parsing(cfg, cases);
+  g4db::bench::sampling(cfg, cases);
+  g4db::bench::scaling(cfg, cases);
+  g4db::bench::crossSection(cfg, cases);
+
+  if (list) {
+    for (const auto& c : cases) std::cout << c.name << "\n";
+    std::cout << std::flush;
+    return 0;
+  }
+
+  for (const auto& name : selected) {
+    if (std::find_if(cases.begin(), cases.end(),
+          [&](const g4db::bench::Case& c) { return c.name == name; }) == cases.end()) {
+      std::cerr << name << " is not a benchmark case, see --list" << std::endl;
+      return 1;
+    }
+  }
+
+  std::FILE* out{stdout};
+  if (not output.empty()) {
+    out = std::fopen(output.c_str(), "w");
+    if (not out) {
+      std::cerr << "ERROR: Unable to open '" << output << "' for writing." << std::endl;
+      return 2;
+    }
+  }
+
+  if (format == "table") {
+    std::fprintf(out, "%-24s %12s %12s %14s\n", "case", "time [s]", "MB/s", "items/s");
+  } else if (format == "csv") {
+    std::fprintf(out, "case,repeat,best_s,mean_s,items,bytes_per_s,items_per_s,geant4,boost\n");
+  } else {
+    std::fprintf(out, "{\n  \"geant4\": %d,\n  \"boost\": \"%s\",\n"
+        "  \"repeat\": %d,\n  \"cases\": [", G4VERSION_NUMBER, BOOST_LIB_VERSION, cfg.repeat);
+  }
+  bool first{true};
+  for (const auto& c : cases) {
+    if (not selected.empty() and std::find(selected.begin(), selected.end(), c.name) == selected.end()) continue;
+    g4db::bench::Result r = g4db::bench::time(c, cfg.repeat);
+    double bytes_per_s = c.bytes > 0 ? c.bytes/r.best : 0.;
+    double items_per_s = r.items/r.best;
+    if (format == "table") {
+      std::fprintf(out, "%-24s %12.6f %12.2f %14.1f\n", c.name.c_str(), r.best,
+          bytes_per_s/1e6, items_per_s);
+    } else if (format == "csv") {
+      std::fprintf(out, "%s,%d,%.9g,%.9g,%zu,%.9g,%.9g,%d,%s\n", c.name.c_str(), cfg.repeat,
+          r.best, r.mean, r.items, bytes_per_s, items_per_s, G4VERSION_NUMBER, BOOST_LIB_VERSION);
+    } else {
+      std::fprintf(out, "%s\n    {\"name\": \"%s\", \"best_s\": %.9g, \"mean_s\": %.9g, "
+          "\"items\": %zu, \"bytes_per_s\": %.9g, \"items_per_s\": %.9g}",
+          first ? "" : ",", c.name.c_str(), r.best, r.mean, r.items, bytes_per_s, items_per_s);
+    }
+    std::fflush(out);
+    first = false;
+  }
+  if (format == "json") std::fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) std::fclose(out);
+
+  return 0;
+} catch (const std::exception& e) {
+  std::cerr << "ERROR: " << e.what() << std::endl;
+  return 127;
+}
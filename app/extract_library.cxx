@@ -5,8 +5,10 @@
 
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 #include "G4DarkBreM/ParseLibrary.h"
+#include "G4DarkBreM/BinaryLibrary.h"
 
 /**
  * printout how to use g4db-extract-library
@@ -16,7 +18,7 @@ void usage() {
       "USAGE:\n"
       "  g4db-extract-library [options] db-lib\n"
       "\n"
-      "  Extract the input DB event library into a single CSV file\n"
+      "  Extract the input DB event library into a single CSV or binary library file\n"
       "\n"
       "ARGUMENTS\n"
       "  db-lib : dark brem event library to load and extract\n"
@@ -25,7 +27,11 @@ void usage() {
       "  -h,--help             : produce this help and exit\n"
       "  -o,--output           : output file to write extracted events to\n"
       "                          use the input library name with the '.csv' extension added by default\n"
+      "                          an output file ending in '.g4dbl' is written as a binary library\n"
+      "  --binary              : write a binary library, use the '.g4dbl' extension by default\n"
       "  --aprime-id           : A' ID number as used in the LHE files\n"
+      "  -j,--threads          : number of threads to use when parsing a directory of files\n"
+      "                          defaults to the number of cores on this machine\n"
       << std::flush;
 }
 
@@ -36,6 +42,8 @@ int main(int argc, char* argv[]) try {
   std::string db_lib{};
   std::string output_filename{};
   int aprime_id{622};
+  bool binary{false};
+  unsigned int n_threads{std::thread::hardware_concurrency()};
   for (int i_arg{1}; i_arg < argc; i_arg++) {
     std::string arg{argv[i_arg]};
     if (arg == "-h" or arg == "--help") {
@@ -47,12 +55,25 @@ int main(int argc, char* argv[]) try {
         return 1;
       }
       output_filename = argv[++i_arg];
+    } else if (arg == "--binary") {
+      binary = true;
     } else if (arg == "--aprime-id") {
       if (i_arg+1 >= argc) {
         std::cerr << arg << " requires an argument after it" << std::endl;
         return 1;
       }
       aprime_id = std::stoi(argv[++i_arg]);
+    } else if (arg == "-j" or arg == "--threads") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      int threads = std::stoi(argv[++i_arg]);
+      if (threads < 1) {
+        std::cerr << arg << " must be at least one" << std::endl;
+        return 1;
+      }
+      n_threads = threads;
     } else if (not arg.empty() and arg[0] == '-') {
       std::cerr << arg << " is not a recognized option" << std::endl;
       return 1;
@@ -69,7 +90,14 @@ int main(int argc, char* argv[]) try {
   if (output_filename.empty()) {
     // remove trailing slash if present
     if (db_lib.back() == '/') db_lib.pop_back();
-    output_filename = db_lib+".csv";
+    output_filename = db_lib+(binary ? g4db::binary::EXTENSION : ".csv");
+  }
+
+  std::map<double, std::vector<g4db::OutgoingKinematics>> lib;
+  if (binary or g4db::binary::isBinaryLibrary(output_filename)) {
+    parseLibrary(db_lib, aprime_id, lib, n_threads);
+    g4db::binary::write(output_filename, lib);
+    return 0;
   }
 
   std::ofstream output{output_filename};
@@ -78,8 +106,7 @@ int main(int argc, char* argv[]) try {
     return 2;
   }
 
-  std::map<double, std::vector<g4db::OutgoingKinematics>> lib;
-  parseLibrary(db_lib, aprime_id, lib);
+  parseLibrary(db_lib, aprime_id, lib, n_threads);
   dumpLibrary(output, lib);
 
   output.close();
@@ -3,8 +3,10 @@
  * definition of g4db-scale executable
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include "G4Electron.hh"
 #include "G4MuonMinus.hh"
@@ -51,7 +53,7 @@ void usage() {
  * We only need to configure the G4DarkBreMModel so
  * we simply define G4APrime and then construct the model
  * so we can call G4DarkBreMModel::scale for the input
- * number of events.
+ * number of events in batches.
  */
 int main(int argc, char* argv[]) try {
   std::string output_filename{"scaled.csv"};
@@ -127,14 +129,21 @@ int main(int argc, char* argv[]) try {
   }
   f << "recoil_energy,recoil_px,recoil_py,recoil_pz\n";
 
-  for (int i_event{0}; i_event < num_events; ++i_event) {
-    G4ThreeVector recoil = db_model.scale(incident_energy, lepton_mass);
-    double recoil_energy = sqrt(recoil.mag2() + lepton_mass*lepton_mass);
-
-    f << recoil_energy << ','
-      << recoil.x() << ','
-      << recoil.y() << ','
-      << recoil.z() << '\n';
+  /*
+   * scale the events in batches so that we can write them out
+   * as we go without holding all of them in memory at once
+   */
+  const std::size_t batch_size{1 << 16};
+  std::vector<double> px(batch_size), py(batch_size), pz(batch_size), energy(batch_size);
+  for (int i_event{0}; i_event < num_events; i_event += batch_size) {
+    std::size_t n = std::min<std::size_t>(batch_size, num_events - i_event);
+    db_model.scale(incident_energy, lepton_mass, n, px.data(), py.data(), pz.data(), energy.data());
+    for (std::size_t i{0}; i < n; i++) {
+      f << energy[i] << ','
+        << px[i] << ','
+        << py[i] << ','
+        << pz[i] << '\n';
+    }
   }
 
   f.close();
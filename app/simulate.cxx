@@ -3,10 +3,24 @@
  * definition of g4db-simulate executable
  */
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <array>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/iostreams/close.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 
 #include "QBBC.hh"
 #include "G4PhysListFactory.hh"
@@ -15,8 +29,20 @@
 #include "G4VUserPrimaryGeneratorAction.hh"
 #include "G4ParticleGun.hh"
 #include "G4UserEventAction.hh"
+#include "G4UserRunAction.hh"
 #include "G4UserTrackingAction.hh"
+#include "G4VUserActionInitialization.hh"
 #include "G4RunManager.hh"
+#include "G4Threading.hh"
+#include "G4Version.hh"
+#include "Randomize.hh"
+#ifdef G4MULTITHREADED
+#if G4VERSION_NUMBER >= 1070
+#include "G4TaskRunManager.hh"
+#else
+#include "G4MTRunManager.hh"
+#endif
+#endif
 #include "G4MuonMinus.hh"
 #include "G4Electron.hh"
 #include "G4Box.hh"
@@ -40,10 +66,16 @@ namespace example {
 
 /**
  * basic physics constructor which simply creates the A' and the dark brem
+ *
+ * In a multi-threaded run, Geant4 constructs the processes once on the
+ * master thread and once on each worker thread with this same physics
+ * constructor, so we keep a handle to each of them.
  */
 class APrimePhysics : public G4VPhysicsConstructor {
-  /// handle to the process, cleaned up when the physics list is desctructed
-  std::unique_ptr<G4DarkBremsstrahlung> the_process_;
+  /// handles to the processes, cleaned up when the physics list is desctructed
+  std::vector<std::unique_ptr<G4DarkBremsstrahlung>> processes_;
+  /// lock on the handles since the worker threads construct processes at the same time
+  mutable std::mutex processes_mutex_;
   /// path to library for the model to load
   std::string library_path_;
   /// mass of A' in GeV
@@ -52,10 +84,21 @@ class APrimePhysics : public G4VPhysicsConstructor {
   bool muons_;
   /// bias factor to apply everywhere
   double bias_;
+  /// beam energy in GeV, the maximum energy of cross section tables
+  double beam_;
+  /// true for tabulating the cross section of each material
+  bool xsec_table_;
+  /// tolerance for interpolating the cross section cache, not used if not positive
+  double xsec_tolerance_;
+  /// file to load cross section cache from, not used if empty
+  std::string xsec_cache_;
  public:
   /// create the physics and store the parameters
-  APrimePhysics(const std::string& lp, double m, bool mu, double b)
-    : G4VPhysicsConstructor("APrime"), library_path_{lp}, ap_mass_{m}, muons_{mu}, bias_{b} {}
+  APrimePhysics(const std::string& lp, double m, bool mu, double b,
+                double beam = -1., bool xt = false, double tol = -1.,
+                const std::string& xc = "")
+    : G4VPhysicsConstructor("APrime"), library_path_{lp}, ap_mass_{m}, muons_{mu}, bias_{b},
+      beam_{beam}, xsec_table_{xt}, xsec_tolerance_{tol}, xsec_cache_{xc} {}
 
   /**
    * Insert A-prime into the Geant4 particle table.
@@ -83,7 +126,7 @@ class APrimePhysics : public G4VPhysicsConstructor {
    * their situation.
    */
   void ConstructProcess() final override {
-    the_process_ = std::unique_ptr<G4DarkBremsstrahlung>(new G4DarkBremsstrahlung(
+    auto process = std::unique_ptr<G4DarkBremsstrahlung>(new G4DarkBremsstrahlung(
         std::shared_ptr<g4db::G4DarkBreMModel>(new g4db::G4DarkBreMModel(
           "forward_only", /* scaling method */
           0.0, /* minimum energy threshold to dark brem [GeV] */
@@ -92,6 +135,42 @@ class APrimePhysics : public G4VPhysicsConstructor {
         false, /* only one per event */
         bias_, /* global bias */
         true /* cache xsec */));
+    // start any tables at the threshold for a dark brem
+    if (xsec_table_) {
+      process->UseMaterialTables(2*ap_mass_*GeV, beam_*GeV, 200);
+    }
+    if (xsec_tolerance_ > 0.) {
+      process->InterpolateCache(2*ap_mass_*GeV, beam_*GeV, xsec_tolerance_);
+    }
+    if (not xsec_cache_.empty()) {
+      process->LoadXsecCache(xsec_cache_);
+    }
+    std::lock_guard<std::mutex> lock(processes_mutex_);
+    processes_.push_back(std::move(process));
+  }
+
+  /**
+   * Number of steps that skipped the cross section calculation
+   *
+   * This is summed over the processes of all of the threads,
+   * so it should only be called while the threads are not running.
+   */
+  std::size_t GetNumFastPathSteps() const {
+    std::lock_guard<std::mutex> lock(processes_mutex_);
+    std::size_t n{0};
+    for (const auto& process : processes_) n += process->GetNumFastPathSteps();
+    return n;
+  }
+
+  /**
+   * Print the counters of the process of each thread
+   *
+   * Like GetNumFastPathSteps, this should only be called
+   * while the threads are not running.
+   */
+  void PrintCounters() const {
+    std::lock_guard<std::mutex> lock(processes_mutex_);
+    for (const auto& process : processes_) process->PrintCounters();
   }
 };  // APrimePhysics
 
@@ -179,6 +258,281 @@ class Hunk : public G4VUserDetectorConstruction {
   }
 };
 
+/**
+ * An output file that chunks of bytes are written to
+ *
+ * If the path ends in '.gz', the chunks are compressed with gzip on a
+ * background thread so that the compression does not slow down the
+ * simulation. Only a few chunks are allowed to wait for the background
+ * thread, so memory stays bounded if the compression cannot keep up.
+ */
+class OutputFile {
+  /// the file being written to
+  std::ofstream file_;
+  /// are we compressing on a background thread?
+  bool compress_;
+  /// chunks waiting to be compressed
+  std::deque<std::string> queue_;
+  /// guard for queue_, done_ and error_
+  std::mutex mutex_;
+  /// signal between the simulation and background threads
+  std::condition_variable cv_;
+  /// have all of the chunks been written?
+  bool done_{false};
+  /// error from the background thread, rethrown by close
+  std::exception_ptr error_;
+  /// the background thread compressing the chunks
+  std::thread compressor_;
+
+  /// maximum number of chunks waiting to be compressed
+  static const std::size_t MAX_QUEUED{8};
+
+  /**
+   * Compress the chunks from the queue into the file until we are done
+   */
+  void compress() try {
+    boost::iostreams::filtering_ostream out;
+    out.push(boost::iostreams::gzip_compressor());
+    out.push(file_);
+    while (true) {
+      std::string chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return done_ or not queue_.empty(); });
+        if (queue_.empty()) break;
+        chunk.swap(queue_.front());
+        queue_.pop_front();
+      }
+      cv_.notify_all();
+      out.write(chunk.data(), chunk.size());
+    }
+    boost::iostreams::close(out);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = std::current_exception();
+    queue_.clear();
+    cv_.notify_all();
+  }
+
+ public:
+  /**
+   * Open the file, starting the background thread if compressing
+   *
+   * @throws std::runtime_error if the file cannot be opened
+   * @param[in] path path to file to write
+   */
+  OutputFile(const std::string& path)
+    : file_{path, std::ios::binary},
+      compress_{path.size() > 3 and path.compare(path.size()-3, 3, ".gz") == 0} {
+    if (not file_.is_open()) {
+      throw std::runtime_error("Unable to open output file '"+path+"'.");
+    }
+    if (compress_) compressor_ = std::thread(&OutputFile::compress, this);
+  }
+
+  /**
+   * Close the file if it hasn't been closed yet, ignoring any errors
+   */
+  ~OutputFile() {
+    try {
+      close();
+    } catch (...) {}
+  }
+
+  /**
+   * Write a chunk of bytes to the file
+   *
+   * @throws std::runtime_error if the file cannot be written
+   * @param[in,out] chunk bytes to write, left empty
+   */
+  void write(std::string& chunk) {
+    if (not compress_) {
+      file_.write(chunk.data(), chunk.size());
+      if (file_.fail()) throw std::runtime_error("Unable to write to output file.");
+      chunk.clear();
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return error_ or queue_.size() < MAX_QUEUED; });
+    if (error_) std::rethrow_exception(error_);
+    queue_.emplace_back();
+    queue_.back().swap(chunk);
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  /**
+   * Finish writing the file
+   *
+   * @throws std::runtime_error if the file cannot be written
+   */
+  void close() {
+    if (compress_ and compressor_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+      }
+      cv_.notify_all();
+      compressor_.join();
+      if (error_) std::rethrow_exception(error_);
+    }
+    if (file_.is_open()) {
+      file_.close();
+      if (file_.fail()) throw std::runtime_error("Unable to write to output file.");
+    }
+  }
+};  // OutputFile
+
+/**
+ * Interface for writing out the four-momenta of the dark brem products
+ *
+ * Writers collect the events into chunks before handing them to the
+ * OutputFile, so they can be compressed without slowing down the simulation.
+ */
+class EventWriter {
+ protected:
+  /// the file we are writing to
+  OutputFile file_;
+  /// the events not written yet
+  std::string chunk_;
+
+  /// size of a chunk in bytes before it is written
+  static const std::size_t CHUNK_SIZE{1 << 20};
+
+ public:
+  /**
+   * Open the output file
+   *
+   * @param[in] path path to file to write
+   */
+  EventWriter(const std::string& path) : file_{path} {
+    chunk_.reserve(CHUNK_SIZE);
+  }
+
+  /// nothing to do, the file is closed by its destructor
+  virtual ~EventWriter() = default;
+
+  /**
+   * Write one event
+   *
+   * @param[in] recoil four-momentum of the recoil lepton (E, px, py, pz) [MeV]
+   * @param[in] aprime four-momentum of the dark photon (E, px, py, pz) [MeV]
+   */
+  virtual void write(const std::array<double,4>& recoil, const std::array<double,4>& aprime) = 0;
+
+  /**
+   * Write the remaining events and close the file
+   *
+   * @throws std::runtime_error if the file cannot be written
+   */
+  virtual void close() {
+    if (not chunk_.empty()) file_.write(chunk_);
+    file_.close();
+  }
+};  // EventWriter
+
+/**
+ * Write the events as CSV text
+ *
+ * The values are written with 17 significant digits,
+ * so they are read back exactly.
+ */
+class CSVWriter : public EventWriter {
+ public:
+  /**
+   * Open the file and write the header row
+   *
+   * @param[in] path path to file to write
+   */
+  CSVWriter(const std::string& path) : EventWriter(path) {
+    chunk_ += "recoil_energy,recoil_px,recoil_py,recoil_pz,aprime_energy,aprime_px,aprime_py,aprime_pz\n";
+  }
+
+  /**
+   * Format the event into the chunk, writing the chunk once it is full
+   */
+  void write(const std::array<double,4>& recoil, const std::array<double,4>& aprime) final override {
+    char row[8*25+1];
+    int n = std::snprintf(row, sizeof(row), "%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+        recoil[0], recoil[1], recoil[2], recoil[3], aprime[0], aprime[1], aprime[2], aprime[3]);
+    chunk_.append(row, n);
+    if (chunk_.size() >= CHUNK_SIZE) file_.write(chunk_);
+  }
+};  // CSVWriter
+
+/**
+ * Write the events in a binary columnar format
+ *
+ * The file starts with a header of 24 bytes in the native byte order:
+ * the magic bytes "G4DBEVT" followed by a null, the format version
+ * (uint32, currently 1), the integer 0x01020304 (uint32) to check the
+ * byte order, and the number of columns (uint64, currently 8).
+ *
+ * The events follow in blocks. Each block is the number of events in
+ * it (uint64) followed by one array of that many doubles for each column
+ * in the same order as the CSV columns: recoil_energy, recoil_px, recoil_py,
+ * recoil_pz, aprime_energy, aprime_px, aprime_py, aprime_pz. All values are
+ * in MeV and are the exact doubles from the simulation.
+ */
+class BinaryWriter : public EventWriter {
+  /// number of columns
+  static const std::size_t N_COLUMNS{8};
+  /// number of events in a full block
+  static const std::size_t BLOCK_SIZE{CHUNK_SIZE/(N_COLUMNS*sizeof(double))};
+  /// the columns of the current block
+  std::vector<double> columns_[N_COLUMNS];
+
+  /**
+   * Append the current block to the chunk and write the chunk
+   */
+  void flush() {
+    std::uint64_t n_events = columns_[0].size();
+    if (n_events == 0) return;
+    chunk_.append(reinterpret_cast<const char*>(&n_events), sizeof(n_events));
+    for (auto& column : columns_) {
+      chunk_.append(reinterpret_cast<const char*>(column.data()), sizeof(double)*column.size());
+      column.clear();
+    }
+    file_.write(chunk_);
+  }
+
+ public:
+  /**
+   * Open the file and write the header
+   *
+   * @param[in] path path to file to write
+   */
+  BinaryWriter(const std::string& path) : EventWriter(path) {
+    const char magic[8] = "G4DBEVT";
+    const std::uint32_t version{1}, byte_order{0x01020304};
+    const std::uint64_t n_columns{N_COLUMNS};
+    chunk_.append(magic, sizeof(magic));
+    chunk_.append(reinterpret_cast<const char*>(&version), sizeof(version));
+    chunk_.append(reinterpret_cast<const char*>(&byte_order), sizeof(byte_order));
+    chunk_.append(reinterpret_cast<const char*>(&n_columns), sizeof(n_columns));
+    for (auto& column : columns_) column.reserve(BLOCK_SIZE);
+  }
+
+  /**
+   * Add the event to the columns, writing the block once it is full
+   */
+  void write(const std::array<double,4>& recoil, const std::array<double,4>& aprime) final override {
+    for (std::size_t i{0}; i < 4; i++) {
+      columns_[i].push_back(recoil[i]);
+      columns_[4+i].push_back(aprime[i]);
+    }
+    if (columns_[0].size() >= BLOCK_SIZE) flush();
+  }
+
+  /**
+   * Write the last partial block and close the file
+   */
+  void close() final override {
+    flush();
+    EventWriter::close();
+  }
+};  // BinaryWriter
+
 /**
  * The event information we care about for studying the model
  *
@@ -228,6 +582,13 @@ class OutgoingKinematics : public G4VUserEventInformation {
     };
   }
 
+  /**
+   * Write out the two four-momenta with the input writer
+   */
+  void write(EventWriter& w) const {
+    w.write(recoil_, aprime_);
+  }
+
   /**
    * Write out the two four-momenta in CSV format to the input stream
    */
@@ -291,40 +652,51 @@ class LeptonBeam : public G4VUserPrimaryGeneratorAction {
 /**
  * event action used to store the OutgoingKinematics *if* a dark brem occurred
  *
- * This uses OutgoingKinematics::stream to write out the CSV where data will be stored.
- * 
- * @note The stream method at the CSV header row written here need to match for the CSV
- * to make sense.
- *
- * We don't do any caching, just trusting the std::ofstream to handle the caching,
- * only flushing when necessary and when destructed.
+ * The four-momenta are handed to an EventWriter which decides
+ * the format of the output file.
  *
  * We also print out the number of events that successfully had a dark brem compared
  * to the number of events requested. This is helpful for the user so that they
  * know (1) there is not a problem and (2) potential tuning of the bias factor.
  */
 class PersistDarkBremProducts : public G4UserEventAction {
-  /// the output file we are writing to
-  std::ofstream out_;
+  /// the writer of the output file
+  std::unique_ptr<EventWriter> writer_;
   /// number of events that we simulated
   long unsigned int events_started_{0};
   /// number of events with a dark brem in it
   long unsigned int events_completed_{0};
  public:
   /**
-   * Open the output CSV and write the header row
+   * Take the writer of the output file
    */
-  PersistDarkBremProducts(const std::string& out_file)
-    : G4UserEventAction(), out_{out_file} {
-    if (not out_.is_open()) {
-      throw std::runtime_error("Unable to open output file '"+out_file+"'.");
+  PersistDarkBremProducts(std::unique_ptr<EventWriter> writer)
+    : G4UserEventAction(), writer_{std::move(writer)} {}
+
+  /// set if finishing any of the output files failed
+  static std::atomic<bool> close_failed;
+
+  /**
+   * Finish writing the output file
+   *
+   * An error is printed and recorded in close_failed instead of thrown
+   * since this is called by Geant4 at the end of the run, possibly on
+   * a worker thread.
+   */
+  void close() {
+    if (not writer_) return;
+    try {
+      writer_->close();
+    } catch (const std::exception& e) {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      close_failed = true;
     }
-    out_ << "recoil_energy,recoil_px,recoil_py,recoil_pz,aprime_energy,aprime_px,aprime_py,aprime_pz\n";
-    out_.flush();
+    writer_.reset();
   }
 
   /**
-   * Print out the number of events with a dark brem compared to the requested number
+   * Print out the number of events with a dark brem compared
+   * to the requested number
    */
   ~PersistDarkBremProducts() {
     std::cout << "[g4db-simulate] Able to generate a dark brem " 
@@ -340,11 +712,33 @@ class PersistDarkBremProducts : public G4UserEventAction {
     auto ek{dynamic_cast<OutgoingKinematics*>(event->GetUserInformation())};
     if (ek->found()) {
       ++events_completed_;
-      ek->stream(out_);
+      ek->write(*writer_);
     }
   }
 };  // PersistDarkBremProducts
 
+std::atomic<bool> PersistDarkBremProducts::close_failed{false};
+
+/**
+ * Close the output file at the end of the run
+ *
+ * Geant4 owns and deletes the event action, so this is where the output
+ * file is finished while any error can still reach the exit status.
+ */
+class CloseOutputFile : public G4UserRunAction {
+  /// the event action writing the output file
+  PersistDarkBremProducts* persist_;
+ public:
+  /// keep the event action writing the output file
+  CloseOutputFile(PersistDarkBremProducts* persist)
+    : G4UserRunAction(), persist_{persist} {}
+
+  /// finish writing the output file
+  void EndOfRunAction(const G4Run*) final override {
+    persist_->close();
+  }
+};  // CloseOutputFile
+
 /**
  * Look through the tracks to find the dark brem products
  */
@@ -368,6 +762,72 @@ class FindDarkBremProducts : public G4UserTrackingAction {
   }
 };  // FindDarkBremProducts
 
+/**
+ * Create the user actions for each thread
+ *
+ * In a multi-threaded run, Build is called once on each worker thread
+ * so each thread has its own actions and writes its own shard of the
+ * output file. The shard of a thread has '_t<thread id>' inserted into
+ * the output file name before its extension (e.g. 'events_t0.csv' for
+ * 'events.csv'), so there is no locking between threads while writing.
+ * A sequential run writes to the output file itself.
+ */
+class ActionInitialization : public G4VUserActionInitialization {
+  /// output file name, before being split into shards
+  std::string output_;
+  /// format of output file, 'csv' or 'binary'
+  std::string format_;
+  /// beam energy in GeV
+  double beam_;
+  /// true for muons, electrons otherwise
+  bool muons_;
+  /// true if each thread should write its own shard
+  bool sharded_;
+ public:
+  /// store the configuration of the actions
+  ActionInitialization(const std::string& output, const std::string& format,
+                       double beam, bool muons, bool sharded)
+    : G4VUserActionInitialization(), output_{output}, format_{format},
+      beam_{beam}, muons_{muons}, sharded_{sharded} {}
+
+  /**
+   * Insert the thread ID into the input output file name
+   *
+   * The ID goes before the first extension of the file name,
+   * so 'events.csv.gz' becomes 'events_t0.csv.gz'.
+   *
+   * @param[in] output output file name
+   * @param[in] id thread ID
+   * @return name of the shard for the thread
+   */
+  static std::string shard(const std::string& output, int id) {
+    std::size_t name = output.find_last_of('/');
+    name = (name == std::string::npos) ? 0 : name+1;
+    // skip a leading dot so hidden files are not treated as all extension
+    std::size_t ext = output.find('.', name+1);
+    if (ext == std::string::npos) ext = output.size();
+    return output.substr(0, ext) + "_t" + std::to_string(id) + output.substr(ext);
+  }
+
+  /**
+   * Create the actions for a worker thread or the sequential run
+   */
+  void Build() const final override {
+    std::string path{sharded_ ? shard(output_, G4Threading::G4GetThreadId()) : output_};
+    std::unique_ptr<EventWriter> writer;
+    if (format_ == "csv") {
+      writer.reset(new CSVWriter(path));
+    } else {
+      writer.reset(new BinaryWriter(path));
+    }
+    SetUserAction(new FindDarkBremProducts);
+    auto persist = new PersistDarkBremProducts(std::move(writer));
+    SetUserAction(persist);
+    SetUserAction(new CloseOutputFile(persist));
+    SetUserAction(new LeptonBeam(beam_, muons_));
+  }
+};  // ActionInitialization
+
 }  // namespace example
 }  // namespace g4db
 
@@ -396,11 +856,26 @@ void usage() {
     "  -d, --depth   : thickness of target in mm (defaults to 18 for electrons, 2000 for muons)\n"
     "  -t, --target  : target material, must be findable by G4NistManager\n"
     "                  (defaults to G4_W for electrons and G4_Cu for muons)\n"
-    "  -o, --output  : output file to write CSV data to (defaults to 'events.csv')\n"
+    "  -o, --output  : output file to write data to (defaults to 'events.csv')\n"
+    "                  if it ends in '.gz', it is compressed with gzip on a background thread\n"
+    "  -f, --format  : format of output file, 'csv' (the default) or 'binary'\n"
+    "                  both hold the exact values, the binary format is described in\n"
+    "                  the documentation of g4db::example::BinaryWriter\n"
     "  -b, --bias    : biasing factor to use to encourage dark brem\n"
     "                  a good starting point is generally the A' mass squared, so that is the default\n"
     "  -e, --beam    : Beam energy in GeV (defaults to 4 for electrons and 100 for muons)\n"
     "  --mat-list    : print the full list from G4NistManager and exit\n"
+    "  --xsec-table  : tabulate the cross section for each material up to the beam energy\n"
+    "                  when the run is initialized rather than computing it during the run\n"
+    "  --xsec-tol    : interpolate the cached cross section on a grid calculated when the\n"
+    "                  run is initialized to this relative tolerance (e.g. 1e-3)\n"
+    "  --xsec-cache  : load the cross section cache from this file written by g4db-xsec-calc\n"
+    "  -j, --threads : number of worker threads to simulate with (defaults to 1)\n"
+    "                  with more than one, each thread writes its own shard of the output\n"
+    "                  with '_t<thread id>' inserted before the extension of the output file\n"
+    "  --seed        : seed for the random number generator (defaults to Geant4's default)\n"
+    "                  each event is seeded from it, so the events do not depend on which\n"
+    "                  thread simulates them\n"
     "\n"
     << std::flush;
 }
@@ -416,9 +891,15 @@ int main(int argc, char* argv[]) try {
   double depth{-1};
   std::string target{};
   std::string output{"events.csv"};
+  std::string format{"csv"};
   double bias{-1.};
   double beam{-1.};
   double ap_mass{-1.};
+  bool xsec_table{false};
+  double xsec_tolerance{-1.};
+  std::string xsec_cache;
+  int threads{1};
+  long seed{-1};
   std::vector<std::string> positional;
   for (int i_arg{1}; i_arg < argc; ++i_arg) {
     std::string arg{argv[i_arg]};
@@ -433,12 +914,36 @@ int main(int argc, char* argv[]) try {
       return 0;
     } else if (arg == "--muons") {
       muons = true;
+    } else if (arg == "--xsec-table") {
+      xsec_table = true;
+    } else if (arg == "--xsec-tol") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      xsec_tolerance = std::stod(argv[++i_arg]);
+    } else if (arg == "--xsec-cache") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      xsec_cache = argv[++i_arg];
     } else if (arg == "-o" or arg == "--output") {
       if (i_arg+1 >= argc) {
         std::cerr << arg << " requires an argument after it" << std::endl;
         return 1;
       }
       output = argv[++i_arg];
+    } else if (arg == "-f" or arg == "--format") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      format = argv[++i_arg];
+      if (format != "csv" and format != "binary") {
+        std::cerr << arg << " must be 'csv' or 'binary'" << std::endl;
+        return 1;
+      }
     } else if (arg == "-t" or arg == "--target") {
       if (i_arg+1 >= argc) {
         std::cerr << arg << " requires an argument after it" << std::endl;
@@ -469,6 +974,22 @@ int main(int argc, char* argv[]) try {
         return 1;
       }
       beam = std::stod(argv[++i_arg]);
+    } else if (arg == "-j" or arg == "--threads") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      threads = std::stoi(argv[++i_arg]);
+      if (threads < 1) {
+        std::cerr << arg << " must be at least one" << std::endl;
+        return 1;
+      }
+    } else if (arg == "--seed") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      seed = std::stol(argv[++i_arg]);
     } else if (arg[0] == '-') {
       std::cerr << arg << " is not a recognized option" << std::endl;
       return 1;
@@ -499,22 +1020,52 @@ int main(int argc, char* argv[]) try {
 
   if (bias < 0.) bias = ap_mass*ap_mass;
 
-  auto run = std::unique_ptr<G4RunManager>(new G4RunManager);
+  if (seed >= 0) G4Random::setTheSeed(seed);
+
+  std::unique_ptr<G4RunManager> run;
+  if (threads > 1) {
+#ifdef G4MULTITHREADED
+#if G4VERSION_NUMBER >= 1070
+    auto mt = new G4TaskRunManager;
+#else
+    auto mt = new G4MTRunManager;
+#endif
+    mt->SetNumberOfThreads(threads);
+    // reseed every event from the master so results don't depend on the scheduling
+    mt->SetSeedOncePerCommunication(0);
+    run.reset(mt);
+#else
+    throw std::runtime_error("Geant4 was built without multi-threading, so only one thread can be used.");
+#endif
+  } else {
+    run.reset(new G4RunManager);
+  }
 
   run->SetUserInitialization(new g4db::example::Hunk(depth,target));
 
+  // each thread constructs its own process, but the models share the library
+  // loaded from the same file so it is only loaded once for the whole process
+  auto aprime_physics = new g4db::example::APrimePhysics(db_lib, ap_mass, muons, bias,
+        beam, xsec_table, xsec_tolerance, xsec_cache);
   G4VModularPhysicsList* physics = new QBBC;
-  physics->RegisterPhysics(new g4db::example::APrimePhysics(db_lib, ap_mass, muons, bias));
+  physics->RegisterPhysics(aprime_physics);
   run->SetUserInitialization(physics);
 
-  run->Initialize();
+  run->SetUserInitialization(new g4db::example::ActionInitialization(
+        output, format, beam, muons, threads > 1));
 
-  run->SetUserAction(new g4db::example::FindDarkBremProducts);
-  run->SetUserAction(new g4db::example::PersistDarkBremProducts(output));
-  run->SetUserAction(new g4db::example::LeptonBeam(beam, muons));
+  run->Initialize();
 
   run->BeamOn(num_events);
 
+  std::cout << "[g4db-simulate] Skipped the dark brem cross section on "
+    << aprime_physics->GetNumFastPathSteps() << " steps below threshold" << std::endl;
+  if (g4db::instrumentation::ENABLED) aprime_physics->PrintCounters();
+
+  if (g4db::example::PersistDarkBremProducts::close_failed) {
+    throw std::runtime_error("Unable to finish writing the output file.");
+  }
+
   return 0;
 } catch (const std::exception& e) {
   std::cerr << "ERROR: " << e.what() << std::endl;
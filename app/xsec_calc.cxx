@@ -3,14 +3,23 @@
  * definition of g4db-xsec-calc executable
  */
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 
 #include "G4DarkBreM/G4DarkBremsstrahlung.h"
 #include "G4DarkBreM/G4DarkBreMModel.h"
 #include "G4DarkBreM/G4APrime.h"
 
+#include "G4Electron.hh"
+
 /**
  * print out how to use g4db-xsec-calc
  */
@@ -29,6 +38,23 @@ void usage() {
     "  --energy     : python-like arange for input energies in GeV (stop, start stop, start stop step)\n"
     "                 default start is 0 and default step is 0.1 GeV\n"
     "  --target     : define target material with two parameters (atomic units): Z A\n"
+    "                 can be given more than once to calculate for several targets\n"
+    "  -j,--threads : number of threads to calculate the cross sections with\n"
+    "                 the output table is the same no matter how many threads are used\n"
+    "  -c,--cache   : also save the calculated cross sections to this file which can be\n"
+    "                 loaded into the cache of the dark brem process (G4DarkBremsstrahlung::LoadXsecCache)\n"
+    "  --method     : scaling method of the model, 'forward_only' (the default), 'cm_scaling', or 'undefined'\n"
+    "  --threshold  : minimum energy in GeV for the lepton to dark brem (default 0)\n"
+    "                 it is always at least twice the A' mass\n"
+    "  --epsilon    : mixing strength of the dark photon (default 1)\n"
+    "                 the method, threshold, and epsilon must match the model that loads\n"
+    "                 the cache file written with --cache, otherwise it is rejected\n"
+    "  --adaptive   : integrate the muon cross sections with the nested adaptive integrals\n"
+    "                 instead of the fixed quadrature rule, for validating the fixed rule\n"
+    "  --check-chi  : instead of calculating cross sections, check that the tabulated electron\n"
+    "                 flux factor chi matches the numerical integral to within the relative\n"
+    "                 tolerance given after it (default 1e-3) at the input energies and the\n"
+    "                 midpoints between them, exiting with a non-zero status if it does not\n"
     << std::flush;
 }
 
@@ -43,9 +69,15 @@ int main(int argc, char* argv[]) try {
   double min_energy{0.};
   double max_energy{4.};
   double energy_step{0.1};
-  double target_Z{74.};
-  double target_A{183.84};
+  std::vector<std::pair<double,double>> targets;
   bool muons{false};
+  unsigned int n_threads{1};
+  std::string cache_filename;
+  double check_chi_tolerance{-1.};
+  bool adaptive{false};
+  std::string method{"forward_only"};
+  double threshold{0.};
+  double epsilon{1.};
   for (int i_arg{1}; i_arg < argc; ++i_arg) {
     std::string arg{argv[i_arg]};
     if (arg == "-h" or arg == "--help") {
@@ -59,6 +91,12 @@ int main(int argc, char* argv[]) try {
         return 1;
       }
       output_filename = argv[++i_arg];
+    } else if (arg == "-c" or arg == "--cache") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      cache_filename = argv[++i_arg];
     } else if (arg == "-M" or arg == "--ap-mass") {
       if (i_arg+1 >= argc) {
         std::cerr << arg << " requires an argument after it" << std::endl;
@@ -92,19 +130,51 @@ int main(int argc, char* argv[]) try {
         std::cerr << arg << " requires two arguments: Z A" << std::endl;
         return 1;
       }
-      target_Z       = std::stod(args[0]);
-      target_A       = std::stod(args[1]);
+      targets.emplace_back(std::stod(args[0]), std::stod(args[1]));
+    } else if (arg == "--method") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      method = argv[++i_arg];
+    } else if (arg == "--threshold") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      threshold = std::stod(argv[++i_arg]);
+    } else if (arg == "--epsilon") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      epsilon = std::stod(argv[++i_arg]);
+    } else if (arg == "--adaptive") {
+      adaptive = true;
+    } else if (arg == "--check-chi") {
+      check_chi_tolerance = 1e-3;
+      if (i_arg+1 < argc and argv[i_arg+1][0] != '-') {
+        check_chi_tolerance = std::stod(argv[++i_arg]);
+      }
+    } else if (arg == "-j" or arg == "--threads") {
+      if (i_arg+1 >= argc) {
+        std::cerr << arg << " requires an argument after it" << std::endl;
+        return 1;
+      }
+      int threads = std::stoi(argv[++i_arg]);
+      if (threads < 1) {
+        std::cerr << arg << " must be at least one" << std::endl;
+        return 1;
+      }
+      n_threads = threads;
     } else {
       std::cout << arg << " is an unrecognized option" << std::endl;
       return 1;
     }
   }
 
-  std::ofstream table_file(output_filename);
-  if (!table_file.is_open()) {
-    std::cerr << "File '" << output_filename << "' was not able to be opened." << std::endl;
-    return 2;
-  }
+  // tungsten if no targets are given
+  if (targets.empty()) targets.emplace_back(74., 183.84);
 
   G4double current_energy = min_energy * GeV;
   energy_step *= GeV;
@@ -117,27 +187,118 @@ int main(int argc, char* argv[]) try {
     << "Max Energy [MeV]  : " << max_energy     << "\n"
     << "Energy Step [MeV] : " << energy_step    << "\n"
     << "Lepton            : " << (muons ? "Muons" : "Electrons") << "\n"
-    << "Target A [amu]    : " << target_A << "\n"
-    << "Target Z [amu]    : " << target_Z << "\n"
+    << "Method            : " << method << "\n"
+    << "Threshold [GeV]   : " << threshold << "\n"
+    << "Epsilon           : " << epsilon << "\n";
+  for (const auto& target : targets) {
+    std::cout
+      << "Target A [amu]    : " << target.second << "\n"
+      << "Target Z [amu]    : " << target.first << "\n";
+  }
+  std::cout
+    << "Threads           : " << n_threads << "\n"
     << std::flush;
 
   // the process accesses the A' mass from the G4 particle
   G4APrime::Initialize(ap_mass*GeV);
-  auto model = std::make_shared<g4db::G4DarkBreMModel>("forward_only",
-        0.0, 1.0, "NOT NEEDED", muons, 622, false);
+  auto model = std::make_shared<g4db::G4DarkBreMModel>(method,
+        threshold, epsilon, "NOT NEEDED", muons, 622, false);
+  model->SetAdaptiveMuonIntegration(adaptive);
+
+  if (check_chi_tolerance > 0.) {
+    if (muons) {
+      std::cerr << "The tabulated chi is only used for electrons." << std::endl;
+      return 1;
+    }
+    const double electron_mass{G4Electron::Electron()->GetPDGMass() / GeV};
+    bool passed{true};
+    for (const auto& target : targets) {
+      double max_diff{0.}, max_diff_energy{0.};
+      for (double ke{min_energy*GeV}; ke < max_energy + energy_step; ke += energy_step/2) {
+        double lepton_e = ke/GeV + electron_mass;
+        double tabulated = model->FluxFactorChiHIWW(target.second, target.first, lepton_e);
+        double numerical = model->FluxFactorChiHIWW(target.second, target.first, lepton_e, false);
+        double diff = std::abs(tabulated/numerical - 1.);
+        if (diff > max_diff) {
+          max_diff = diff;
+          max_diff_energy = ke;
+        }
+      }
+      std::cout << "Z = " << target.first << ", A = " << target.second
+        << " : max relative difference " << max_diff
+        << " at " << max_diff_energy << " MeV" << std::endl;
+      if (max_diff > check_chi_tolerance) passed = false;
+    }
+    if (not passed) {
+      std::cerr << "Tabulated chi differs from the numerical integral by more than "
+        << check_chi_tolerance << std::endl;
+      return 3;
+    }
+    return 0;
+  }
+
+  std::ofstream table_file(output_filename);
+  if (!table_file.is_open()) {
+    std::cerr << "File '" << output_filename << "' was not able to be opened." << std::endl;
+    return 2;
+  }
+
   // wrap the created model in the cache so we can use it
   // to hold the xsec table and write out the CSV later
   g4db::ElementXsecCache cache(model);
 
+  /*
+   * Each (target, energy) point is an independent calculation, so we list
+   * them all and then the threads each take the next uncalculated point
+   * when they finish their current one. The cache is sorted by target and
+   * energy, so the output table does not depend on the order the points
+   * were calculated in.
+   */
+  std::vector<G4double> energies;
+  while (current_energy < max_energy + energy_step) {
+    energies.push_back(current_energy);
+    current_energy += energy_step;
+  }
+  std::size_t n_points = energies.size()*targets.size();
+  std::atomic<std::size_t> next_point{0}, n_done{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    for (std::size_t i_point = next_point++; i_point < n_points; i_point = next_point++) {
+      const auto& target{targets[i_point / energies.size()]};
+      try {
+        cache.get(energies[i_point % energies.size()], target.second, target.first);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (not error) error = std::current_exception();
+        failed = true;
+        next_point = n_points;
+      }
+      n_done++;
+    }
+  };
+  /*
+   * With one thread, we calculate on the main thread like before. Otherwise
+   * the workers are threads Geant4 doesn't know about, so they only go
+   * through the model, which looked up the particle definitions it needs
+   * when it was constructed above on the main thread.
+   */
+  if (n_threads == 1) worker();
+  std::vector<std::thread> threads;
+  for (unsigned int i_thread{0}; n_threads > 1 and i_thread < n_threads; i_thread++) {
+    threads.emplace_back(worker);
+  }
+
   int bar_width = 80;
   int pos = 0;
   bool is_redirected = (isatty(STDOUT_FILENO) == 0);
-  while (current_energy < max_energy + energy_step) {
-    cache.get(current_energy, target_A, target_Z);
-    current_energy += energy_step;
+  while (n_done < n_points and not failed) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
     if (not is_redirected) {
+      double fraction = double(n_done) / n_points;
       int old_pos{pos};
-      pos = bar_width * current_energy / max_energy;
+      pos = bar_width * fraction;
       if (pos != old_pos) {
         std::cout << "[";
         for (int i{0}; i < bar_width; ++i) {
@@ -145,17 +306,21 @@ int main(int argc, char* argv[]) try {
           else if (i == pos) std::cout << ">";
           else std::cout << " ";
         }
-        std::cout << "] " << int(current_energy / max_energy * 100.0) << " %\r";
+        std::cout << "] " << int(fraction * 100.0) << " %\r";
         std::cout.flush();
       }
     }
   }
+  for (auto& thread : threads) thread.join();
   if (not is_redirected) std::cout << std::endl;
+  if (error) std::rethrow_exception(error);
 
   table_file << cache;
 
   table_file.close();
 
+  if (not cache_filename.empty()) cache.save(cache_filename);
+
   return 0;
 } catch (const std::exception& e) {
   std::cerr << "ERROR: " << e.what() << std::endl;
@@ -0,0 +1,211 @@
+/**
+ * @file BinaryLibrary.h
+ * Declaration of the binary dark brem event library format
+ */
+
+#ifndef G4DARKBREM_BINARYLIBRARY_H
+#define G4DARKBREM_BINARYLIBRARY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <map>
+#include <vector>
+
+#include "G4DarkBreM/ParseLibrary.h"
+#include "G4DarkBreM/EventLibrary.h"
+
+namespace g4db {
+
+/**
+ * namespace holding the binary library format
+ *
+ * The text formats (LHE and CSV) need to be parsed line-by-line
+ * every time a library is loaded. For large libraries, this parsing
+ * dominates the start-up time of a simulation job. The binary format
+ * defined here is laid out so that it can be memory-mapped and sampled
+ * from directly without any parsing or copying.
+ *
+ * The file is composed of three sections, all of which are aligned
+ * on eight bytes and written in the native byte order of the machine
+ * that wrote the file.
+ *
+ * 1. A fixed-size Header identifying the file and the sizes of the
+ *    other sections.
+ * 2. The energy index: the sorted incident energies [GeV] followed by
+ *    the offsets (into the columns) of the first event of each energy.
+ *    There is one more offset than energies so that the events of
+ *    energy `i` are in the range `[offset[i], offset[i+1])`.
+ * 3. The packed kinematics columns: one contiguous array of doubles
+ *    for each EventLibrary::Column holding that quantity for all of the events.
+ *
+ * The incident energy is not stored per event since it is already
+ * available from the energy index.
+ */
+namespace binary {
+
+/// file extension identifying binary libraries
+extern const std::string EXTENSION;
+
+/// current version of the binary format written by write
+static const std::uint32_t VERSION{1};
+
+/**
+ * Header at the beginning of a binary library
+ *
+ * The byte offsets are relative to the start of the file.
+ */
+struct Header {
+  /// magic bytes identifying the file, always "G4DBLIB" followed by a null
+  char magic[8];
+  /// version of the format
+  std::uint32_t version;
+  /// a known integer to check that the byte order matches
+  std::uint32_t byte_order;
+  /// number of columns in the file
+  std::uint64_t n_columns;
+  /// number of incident energies in the library
+  std::uint64_t n_energies;
+  /// total number of events in the library
+  std::uint64_t n_events;
+  /// byte offset of the array of incident energies
+  std::uint64_t energies_offset;
+  /// byte offset of the array of event offsets
+  std::uint64_t events_offset;
+  /// byte offset of the first column
+  std::uint64_t columns_offset;
+};  // Header
+
+/**
+ * Check if the input path is a binary library based on its extension
+ *
+ * @param[in] path path to check
+ * @return true if path ends in EXTENSION
+ */
+bool isBinaryLibrary(const std::string& path);
+
+/**
+ * Write the input library to a binary file
+ *
+ * @throws std::runtime_error if the file cannot be opened or written
+ * @param[in] path path to file to write
+ * @param[in] lib library to write out
+ */
+void write(const std::string& path, const std::map<double, std::vector<OutgoingKinematics>>& lib);
+
+/**
+ * A binary library memory-mapped into this process
+ *
+ * The file is mapped read-only and all of the accessors point directly
+ * into the mapped memory. Nothing is parsed or copied when opening
+ * the library, and the operating system is left to page in the parts
+ * of the file that are actually accessed. The mapping is advised to be
+ * accessed randomly so that touching the events of one incident energy
+ * does not read ahead into the others. With G4DarkBreMModel only reading
+ * the incident energies it samples, the memory used by a run then
+ * depends on the range of energies in use rather than on the size of
+ * the library.
+ */
+class MappedLibrary {
+ public:
+  /**
+   * Map the input file into memory
+   *
+   * @throws std::runtime_error if the file cannot be mapped or
+   * is not a valid binary library
+   * @param[in] path path to binary library
+   */
+  MappedLibrary(const std::string& path);
+
+  /**
+   * Unmap the file
+   */
+  ~MappedLibrary();
+
+  /// number of incident energies in the library
+  std::size_t numEnergies() const { return header_->n_energies; }
+
+  /// total number of events in the library
+  std::size_t numEvents() const { return header_->n_events; }
+
+  /// sorted array of incident energies [GeV]
+  const double* energies() const { return energies_; }
+
+  /// offsets of the first event of each energy, one more than the energies
+  const std::uint64_t* offsets() const { return offsets_; }
+
+  /**
+   * Get a column
+   *
+   * @param[in] c column to get
+   * @return pointer to the first value of the column
+   */
+  const double* column(EventLibrary::Column c) const { return columns_[c]; }
+
+  /// size of the mapped file in bytes
+  std::size_t size() const { return size_; }
+
+  /**
+   * Number of events for the input energy
+   *
+   * @param[in] i_energy index of the incident energy
+   * @return number of events at that incident energy
+   */
+  std::size_t numEvents(std::size_t i_energy) const {
+    return offsets_[i_energy+1] - offsets_[i_energy];
+  }
+
+  /**
+   * Get an event from the library
+   *
+   * This does no bounds checking and does not allocate any memory.
+   *
+   * @param[in] i_energy index of the incident energy
+   * @param[in] i_event index of the event within that incident energy
+   * @return kinematics of that event
+   */
+  OutgoingKinematics at(std::size_t i_energy, std::size_t i_event) const {
+    std::size_t i = offsets_[i_energy] + i_event;
+    OutgoingKinematics ok;
+    ok.E = energies_[i_energy];
+    ok.lepton = CLHEP::HepLorentzVector(
+        columns_[EventLibrary::RecoilPx][i], columns_[EventLibrary::RecoilPy][i],
+        columns_[EventLibrary::RecoilPz][i], columns_[EventLibrary::RecoilE][i]);
+    ok.centerMomentum = CLHEP::HepLorentzVector(
+        columns_[EventLibrary::CenterPx][i], columns_[EventLibrary::CenterPy][i],
+        columns_[EventLibrary::CenterPz][i], columns_[EventLibrary::CenterE][i]);
+    return ok;
+  }
+
+  /**
+   * Copy the mapped library into the in-memory library format
+   *
+   * @param[in,out] lib library to add events to
+   */
+  void fill(std::map<double, std::vector<OutgoingKinematics>>& lib) const;
+
+ private:
+  /// no copying since we own the mapping
+  MappedLibrary(const MappedLibrary&);
+  /// no assignment since we own the mapping
+  MappedLibrary& operator=(const MappedLibrary&);
+
+ private:
+  /// start of the mapped memory
+  void* mapping_;
+  /// size of the mapped memory in bytes
+  std::size_t size_;
+  /// header at the start of the mapping
+  const Header* header_;
+  /// incident energies
+  const double* energies_;
+  /// offsets of first event for each energy
+  const std::uint64_t* offsets_;
+  /// start of each column
+  const double* columns_[EventLibrary::NColumns];
+};  // MappedLibrary
+
+}  // namespace binary
+}  // namespace g4db
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file CMScaling.h
+ * Declaration of the batch kernel for the CMScaling method
+ */
+
+#ifndef G4DARKBREM_CMSCALING_H
+#define G4DARKBREM_CMSCALING_H
+
+#include <cstddef>
+
+#include "G4DarkBreM/EventLibrary.h"
+
+namespace g4db {
+
+/**
+ * Scale a batch of library events with the CMScaling method
+ *
+ * This is the same calculation as scaling each event with CLHEP
+ * Lorentz vectors: boost the recoil lepton out of the library's
+ * center-of-momentum (CoM) frame, then boost it into the CoM frame
+ * with \f$p_z\f$ and energy lowered by the difference between the
+ * sampled and incident energies. Instead of constructing the vectors
+ * for each event, the boosts are written out component-wise and
+ * applied to whole columns of events at once so that the compiler
+ * can keep several events in the lanes of the SIMD registers.
+ *
+ * On x86-64 Linux, the kernel is compiled for AVX-512 and AVX2 as well
+ * as the baseline instruction set and the best one supported by the
+ * running machine is chosen when the library is loaded. The kernel is
+ * compiled without fusing multiplies and adds, so every instruction set
+ * and any batch size give identical results. These agree with the CLHEP
+ * calculation to within rounding.
+ *
+ * @param[in] n number of events to scale
+ * @param[in] columns pointers to the first of n values of each
+ * EventLibrary::Column, indexed by the column
+ * @param[in] sample_energy incident energy of the events in the library [GeV]
+ * @param[in] incident_energy actual incident energy of the lepton [GeV]
+ * @param[in] lepton_mass mass of the lepton [GeV]
+ * @param[in] ke_ratio ratio of the actual to the sampled kinetic energy
+ * available to the recoil and A'
+ * @param[out] e_acc scaled recoil energy for each event [GeV]
+ * @param[out] pt scaled recoil transverse momentum for each event [GeV]
+ * @param[out] p scaled recoil momentum magnitude for each event [GeV]
+ */
+void cmScaling(std::size_t n, const double* const columns[EventLibrary::NColumns],
+               double sample_energy, double incident_energy, double lepton_mass,
+               double ke_ratio, double* e_acc, double* pt, double* p);
+
+}  // namespace g4db
+
+#endif
@@ -0,0 +1,317 @@
+/**
+ * @file ConcurrentMap.h
+ * Declaration and definition of a map and a value which can be shared between threads
+ */
+
+#ifndef G4DARKBREM_CONCURRENTMAP_H
+#define G4DARKBREM_CONCURRENTMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace g4db {
+
+/**
+ * A value that is set at most once and can be shared between threads
+ *
+ * Reading a value that has been set only takes an atomic load. If several
+ * threads ask for the value with getOrCompute before it is set, the first
+ * calculates it and the others wait for it to be done instead of
+ * calculating it again.
+ *
+ * @tparam T type of value, must be default constructible
+ */
+template <typename T>
+class OnceValue {
+ public:
+  /// the value starts unset
+  OnceValue() : state_{EMPTY} {}
+
+  /**
+   * Get the value if it is set
+   *
+   * This does not wait for a value that another thread is still calculating.
+   *
+   * @return pointer to the value, nullptr if it isn't set yet
+   */
+  const T* get() const {
+    return state_.load(std::memory_order_acquire) == READY ? &value_ : nullptr;
+  }
+
+  /**
+   * Get the value, calculating it if it isn't set
+   *
+   * If compute throws, the value is left unset and the exception is passed
+   * on. A thread that was waiting for that calculation then calculates the
+   * value itself, so it sees the same exception instead of a generic one
+   * and a later call can still succeed.
+   *
+   * @throws any exception thrown by compute
+   * @tparam F type of function calculating value
+   * @param[in] compute function returning the value if it isn't set
+   * @return the value
+   */
+  template <typename F>
+  const T& getOrCompute(F compute) {
+    while (true) {
+      int state{EMPTY};
+      if (state_.compare_exchange_strong(state, COMPUTING, std::memory_order_acq_rel)) {
+        try {
+          value_ = compute();
+        } catch (...) {
+          state_.store(EMPTY, std::memory_order_release);
+          throw;
+        }
+        state_.store(READY, std::memory_order_release);
+        return value_;
+      }
+      while (state == COMPUTING) {
+        std::this_thread::yield();
+        state = state_.load(std::memory_order_acquire);
+      }
+      if (state == READY) return value_;
+      // the calculation failed and the value is unset again, try ourselves
+    }
+  }
+
+  /**
+   * Set the value if it isn't set yet
+   *
+   * @param[in] value value to set
+   * @return true if the value was set by this call
+   */
+  bool set(const T& value) {
+    int state{EMPTY};
+    if (not state_.compare_exchange_strong(state, COMPUTING, std::memory_order_acq_rel)) {
+      return false;
+    }
+    value_ = value;
+    state_.store(READY, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  /// no copying since other threads may be waiting on us
+  OnceValue(const OnceValue&);
+  /// no assignment since other threads may be waiting on us
+  OnceValue& operator=(const OnceValue&);
+
+  /// the value is not set and no one is calculating it
+  static const int EMPTY{0};
+
+  /// the value is being calculated
+  static const int COMPUTING{1};
+
+  /// the value is set
+  static const int READY{2};
+
+ private:
+  /// state of the value
+  std::atomic<int> state_;
+  /// the value, only written by the thread that moved the state out of EMPTY
+  T value_;
+};  // OnceValue
+
+/**
+ * A map from integer keys to values that can be shared between threads
+ *
+ * Entries are only ever added, never changed or removed, so reading an
+ * entry that is already in the map does not take any locks. It is an open
+ * addressing hash table with linear probing. When the probing for a key
+ * runs too long, the key goes into a second table twice the size which is
+ * chained onto the first and so on. The tables are never moved, so a
+ * reference to a value stays valid as long as the map.
+ *
+ * Each value is a OnceValue, so it is inserted only once and if several
+ * threads ask for the same missing key with getOrCompute, the first
+ * calculates the value and the others wait for it.
+ *
+ * @tparam T type of value, must be default constructible
+ */
+template <typename T>
+class ConcurrentMap {
+ public:
+  /// type of key in the map
+  typedef std::uint64_t key_t;
+
+  /**
+   * Create an empty map
+   *
+   * @param[in] capacity number of entries in the first table, rounded up
+   * to a power of two
+   */
+  explicit ConcurrentMap(std::size_t capacity = 1024) {
+    std::size_t c{MAX_PROBES};
+    while (c < capacity) c *= 2;
+    head_ = new Table(c);
+  }
+
+  /**
+   * Delete the chain of tables
+   */
+  ~ConcurrentMap() {
+    Table* t = head_;
+    while (t) {
+      Table* next = t->next.load(std::memory_order_relaxed);
+      delete t;
+      t = next;
+    }
+  }
+
+  /**
+   * Find the value for the input key
+   *
+   * This does not take any locks and does not wait for a value
+   * that another thread is still calculating.
+   *
+   * @param[in] key key to look for
+   * @return pointer to the value, nullptr if it isn't in the map yet
+   */
+  const T* find(key_t key) const {
+    const key_t stored = key + 1;
+    for (const Table* t = head_; t; t = t->next.load(std::memory_order_acquire)) {
+      for (std::size_t i{0}; i < MAX_PROBES; i++) {
+        const Slot& slot{t->slots[(t->hash(stored) + i) & t->mask]};
+        key_t k = slot.key.load(std::memory_order_acquire);
+        // keys are never removed, so the key is not further along
+        if (k == EMPTY) return nullptr;
+        if (k == stored) return slot.value.get();
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Get the value for the input key, calculating it if it is missing
+   *
+   * @throws any exception thrown by compute
+   * @tparam F type of function calculating value
+   * @param[in] key key to look for
+   * @param[in] compute function returning the value if it is missing
+   * @return value for the key
+   */
+  template <typename F>
+  const T& getOrCompute(key_t key, F compute) {
+    return slot(key).value.getOrCompute(compute);
+  }
+
+  /**
+   * Insert a value if the key is not in the map yet
+   *
+   * @param[in] key key to insert
+   * @param[in] value value to insert
+   * @return true if the value was inserted
+   */
+  bool insert(key_t key, const T& value) {
+    return slot(key).value.set(value);
+  }
+
+  /**
+   * Call the input function for each entry with a value
+   *
+   * The entries are not in any particular order and entries added
+   * while this is running may or may not be included.
+   *
+   * @tparam F type of function
+   * @param[in] f function called with the key and value of each entry
+   */
+  template <typename F>
+  void forEach(F f) const {
+    for (const Table* t = head_; t; t = t->next.load(std::memory_order_acquire)) {
+      for (std::size_t i{0}; i <= t->mask; i++) {
+        const Slot& slot{t->slots[i]};
+        key_t k = slot.key.load(std::memory_order_acquire);
+        const T* value{k == EMPTY ? nullptr : slot.value.get()};
+        if (value) f(k - 1, *value);
+      }
+    }
+  }
+
+ private:
+  /// stored key of slots that have not been claimed, keys are stored plus one
+  static const key_t EMPTY{0};
+
+  /// number of slots probed in a table before moving on to the next one
+  static const std::size_t MAX_PROBES{16};
+
+  /**
+   * An entry in a table
+   */
+  struct Slot {
+    /// stored key, EMPTY until claimed
+    std::atomic<key_t> key{EMPTY};
+    /// value for the key
+    OnceValue<T> value;
+  };
+
+  /**
+   * One table of slots in the chain
+   */
+  struct Table {
+    /// allocate the slots, capacity must be a power of two
+    explicit Table(std::size_t capacity)
+      : mask{capacity-1}, slots{new Slot[capacity]}, next{nullptr} {}
+    /// first slot to probe for a stored key
+    std::size_t hash(key_t stored) const {
+      return std::size_t((stored*0x9E3779B97F4A7C15ull) >> 32);
+    }
+    /// capacity minus one for wrapping the index of probed slots
+    const std::size_t mask;
+    /// the slots
+    std::unique_ptr<Slot[]> slots;
+    /// next table in the chain, nullptr if this is the last one
+    std::atomic<Table*> next;
+  };
+
+  /**
+   * Find the slot for a key, claiming an empty slot if it isn't in the map
+   *
+   * Threads looking for the same key probe the same slots in the same
+   * order, so they all stop at the same empty slot and only one of them
+   * claims it.
+   *
+   * @param[in] key key to look for
+   * @return slot for the key
+   */
+  Slot& slot(key_t key) {
+    const key_t stored = key + 1;
+    Table* t = head_;
+    while (true) {
+      for (std::size_t i{0}; i < MAX_PROBES; i++) {
+        Slot& s{t->slots[(t->hash(stored) + i) & t->mask]};
+        key_t k = s.key.load(std::memory_order_acquire);
+        if (k == EMPTY) {
+          if (s.key.compare_exchange_strong(k, stored, std::memory_order_acq_rel)) return s;
+          // k now holds the key that another thread claimed this slot for
+        }
+        if (k == stored) return s;
+      }
+      Table* next = t->next.load(std::memory_order_acquire);
+      if (not next) {
+        Table* bigger = new Table(2*(t->mask+1));
+        if (t->next.compare_exchange_strong(next, bigger, std::memory_order_acq_rel)) {
+          next = bigger;
+        } else {
+          delete bigger;
+        }
+      }
+      t = next;
+    }
+  }
+
+  /// no copying since the tables are owned
+  ConcurrentMap(const ConcurrentMap&);
+  /// no assignment since the tables are owned
+  ConcurrentMap& operator=(const ConcurrentMap&);
+
+ private:
+  /// first table in the chain
+  Table* head_;
+};  // ConcurrentMap
+
+}  // namespace g4db
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef G4DarkBREM_ELEMENTXSECCACHE_H
 #define G4DarkBREM_ELEMENTXSECCACHE_H
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
+#include "G4DarkBreM/ConcurrentMap.h"
+#include "G4DarkBreM/Instrumentation.h"
 #include "G4DarkBreM/PrototypeModel.h"
 
 namespace g4db {
@@ -13,6 +18,24 @@ namespace g4db {
  * We make a specific class for the cache in order
  * to keep the key encoding/decoding process in a central
  * location.
+ *
+ * By default, the cross section is calculated and stored for each
+ * integer MeV of energy that is requested. Alternatively, the cache
+ * can be configured with interpolate so that the cross section of each
+ * element is calculated once on a grid of energies and then served
+ * by interpolating within that grid.
+ *
+ * The calculated cross sections are shared between all of the caches
+ * whose models have the same cross section parameters
+ * (PrototypeModel::GetXsecParameters), so when each worker thread has its
+ * own process and model, each cross section is still only calculated once
+ * per program. Cross sections that are already calculated are read without
+ * taking any locks. Copies of a cache share the same cross sections as well.
+ *
+ * The cross sections of each element are stored in an array indexed
+ * by the integer MeV of energy, so getting a cross section that is
+ * already calculated is a lookup of the element in a small hash table
+ * (ConcurrentMap) and then a direct index into the array of that element.
  */
 class ElementXsecCache {
  public:
@@ -22,18 +45,75 @@ class ElementXsecCache {
    * Does nothing interesting, but no model for calculating cross section has
    * been set.
    */
-  ElementXsecCache() = default;
+  ElementXsecCache();
 
   /**
    * Constructor with a model to calculate the cross section.
+   *
+   * The cache shares its cross sections with the other caches
+   * whose models have the same cross section parameters. If the model
+   * does not provide its parameters, the cache is not shared.
+   *
+   * @param[in] model model to calculate cross sections with
+   */
+  ElementXsecCache(std::shared_ptr<PrototypeModel> model);
+
+  /**
+   * Serve the cross sections by interpolating within a grid of energies
+   *
+   * The grid for an element starts as POINTS_PER_DECADE log-spaced energies
+   * between the minimum and maximum energy. Each interval of the grid is
+   * then split at its (logarithmic) midpoint until linearly interpolating
+   * across the interval predicts the cross section at the midpoint within
+   * the relative tolerance. Cross sections below a thousandth of the largest
+   * cross section on the initial grid are only required to be within the
+   * tolerance of that floor, so the steep turn-on at threshold does not cause
+   * endless refinement. An interval is not split more than MAX_DEPTH times.
+   *
+   * The grid for an element is built the first time that element is
+   * requested or when calling prepare. Energies outside of the grid are
+   * cached at the 1 MeV level as usual.
+   *
+   * The grids are shared between the caches that share cross sections
+   * and are interpolating with the same energy range and tolerance.
+   *
+   * This should be called before the cache is used since it is not
+   * guarded against concurrent calls to get.
+   *
+   * @throws std::runtime_error if the energy range or tolerance is not sensible
+   * @param[in] min_energy minimum energy of the grid [MeV]
+   * @param[in] max_energy maximum energy of the grid [MeV]
+   * @param[in] tolerance target relative accuracy of the interpolation
+   */
+  void interpolate(G4double min_energy, G4double max_energy, double tolerance);
+
+  /**
+   * Check if the cross sections are interpolated
+   *
+   * @returns true if interpolate has been called
    */
-  ElementXsecCache(std::shared_ptr<PrototypeModel> model)
-      : model_{model} {}
+  bool interpolating() const { return interpolate_; }
+
+  /**
+   * Build the grid of cross sections for the input element
+   *
+   * This is only useful when interpolating and does nothing if the grid
+   * has already been built. Calling this for all of the elements before
+   * a run starts moves the cost of calculating the cross sections out of
+   * the first events.
+   *
+   * @throws std::runtime_error if no model is available for calculating cross sections
+   * @param[in] A atomic mass of element [atomic mass units]
+   * @param[in] Z atomic number of element [num protons]
+   */
+  void prepare(G4double A, G4double Z);
 
   /**
    * Get the value of the cross section for the input variables
    * and calculate the cross section if it wasn't calculated before.
    *
+   * This can be called from several threads at once.
+   *
    * @throws std::runtime_error if no model is available for calculating cross sections
    * @param[in] energy Energy of incident lepton [MeV]
    * @param[in] A atomic mass of element [atomic mass units]
@@ -43,6 +123,26 @@ class ElementXsecCache {
    */
   G4double get(G4double energy, G4double A, G4double Z);
 
+  /**
+   * Number of calls to get that did not calculate a cross section
+   *
+   * This includes cross sections calculated by another cache sharing
+   * ours and interpolated cross sections. It is only counted if
+   * instrumentation::ENABLED.
+   *
+   * @returns number of cache hits
+   */
+  std::uint64_t numHits() const { return hits_.get(); }
+
+  /**
+   * Number of calls to get that calculated a cross section
+   *
+   * It is only counted if instrumentation::ENABLED.
+   *
+   * @returns number of cache misses
+   */
+  std::uint64_t numMisses() const { return misses_.get(); }
+
   /**
    * Stream the entire table into the output stream.
    *
@@ -50,6 +150,32 @@ class ElementXsecCache {
    */
   void stream(std::ostream& o) const;
 
+  /**
+   * Save the 1 MeV cache entries to a file that can be loaded later
+   *
+   * The file starts with a comment line holding the parameters of the model
+   * (from PrototypeModel::GetXsecParameters) followed by the same CSV table
+   * that stream writes, except with full double precision so that the cross
+   * sections are read back to within rounding. Interpolation grids are not saved since they
+   * depend on the configuration of the interpolation.
+   *
+   * @throws std::runtime_error if no model is available or the file cannot be written
+   * @param[in] path path to file to write
+   */
+  void save(const std::string& path) const;
+
+  /**
+   * Load the cache entries from a file written by save
+   *
+   * The loaded entries are added to any that are already in the cache,
+   * entries that are already in the cache are kept.
+   *
+   * @throws std::runtime_error if no model is available, the file cannot be read,
+   * or the file was written by a model with different parameters than ours
+   * @param[in] path path to file to read
+   */
+  void load(const std::string& path);
+
   /**
    * Overload the streaming operator for ease
    *
@@ -64,7 +190,10 @@ class ElementXsecCache {
 
  private:
   /// The type for the key we use in the cache
-  typedef unsigned long int key_t;
+  typedef ConcurrentMap<G4double>::key_t key_t;
+
+  /// The start of the comment line holding the model parameters in saved files
+  static const std::string PARAMETERS_PREFIX;
 
   /// The maximum value of A
   static const key_t MAX_A{1000};
@@ -89,13 +218,114 @@ class ElementXsecCache {
    */
   key_t computeKey(G4double energy, G4double A, G4double Z) const;
 
+  /**
+   * The cross sections of one element at each MeV of energy
+   *
+   * Defined in the source file since it is only used there.
+   */
+  class EnergyTable;
+
+  /**
+   * Get the table of cross sections for an element, creating it if it doesn't exist yet
+   *
+   * @param[in] A atomic mass of element [atomic mass units]
+   * @param[in] Z atomic number of element [num protons]
+   * @returns table for the element, never moved once created
+   */
+  EnergyTable& table(G4double A, G4double Z);
+
+  /**
+   * Get all of the calculated 1 MeV entries
+   *
+   * @returns map from cache key (computeKey) to cross section
+   */
+  std::map<key_t, G4double> entries() const;
+
+  /// number of points per decade of energy in the initial grid
+  static const int POINTS_PER_DECADE{10};
+
+  /// maximum number of times an interval of the initial grid is split
+  static const int MAX_DEPTH{12};
+
+  /**
+   * The energies and cross sections of an element for interpolating
+   */
+  struct Grid {
+    /// sorted energies [MeV]
+    std::vector<G4double> energies;
+    /// cross sections at those energies
+    std::vector<G4double> xsecs;
+  };
+
+  /**
+   * Get the grid for an element, building it if it doesn't exist yet
+   *
+   * @param[in] A atomic mass of element [atomic mass units]
+   * @param[in] Z atomic number of element [num protons]
+   * @returns grid for the element, never moved once built
+   */
+  const Grid& grid(G4double A, G4double Z);
+
+  /**
+   * Calculate the grid for an element
+   *
+   * @param[in] A atomic mass of element [atomic mass units]
+   * @param[in] Z atomic number of element [num protons]
+   * @returns grid for the element
+   */
+  Grid buildGrid(G4double A, G4double Z) const;
+
+  /**
+   * Add points to the grid between the two input points until
+   * the interpolation tolerance is met
+   *
+   * The points are added in order, the bounds are not added.
+   *
+   * @param[in] A atomic mass of element [atomic mass units]
+   * @param[in] Z atomic number of element [num protons]
+   * @param[in] e_low low energy of interval [MeV]
+   * @param[in] xsec_low cross section at low energy
+   * @param[in] e_high high energy of interval [MeV]
+   * @param[in] xsec_high cross section at high energy
+   * @param[in] floor cross section below which the tolerance is absolute
+   * @param[in] depth number of times this interval has been split
+   * @param[in,out] g grid to add points to
+   */
+  void refine(G4double A, G4double Z, G4double e_low, G4double xsec_low,
+              G4double e_high, G4double xsec_high, G4double floor,
+              int depth, Grid& g) const;
+
  private:
-  /// the actual map from cache keys to calculated cross sections
-  std::map<key_t, G4double> the_cache_;
+  /// the tables of cross sections keyed by computeKey with zero energy, shared with other caches
+  std::shared_ptr<ConcurrentMap<std::shared_ptr<EnergyTable>>> the_cache_;
 
   /// shared pointer to the model for calculating cross sections
   std::shared_ptr<PrototypeModel> model_;
 
+  /// the grids of cross sections for interpolating, keyed by computeKey with zero energy
+  std::shared_ptr<ConcurrentMap<Grid>> the_grids_;
+
+  /// parameters of the model identifying the shared cross sections, empty if not shared
+  std::string shared_id_;
+
+  /// are we interpolating?
+  bool interpolate_{false};
+
+  /// minimum energy of the grids [MeV]
+  G4double min_energy_{0.};
+
+  /// maximum energy of the grids [MeV]
+  G4double max_energy_{0.};
+
+  /// target relative accuracy of interpolation
+  double tolerance_{0.};
+
+  /// number of calls to get that did not calculate a cross section
+  instrumentation::Counter hits_;
+
+  /// number of calls to get that calculated a cross section
+  instrumentation::Counter misses_;
+
 };  // ElementXsecCache
 
 }
@@ -0,0 +1,235 @@
+/**
+ * @file EventLibrary.h
+ * Declaration of the compact storage of a dark brem event library
+ */
+
+#ifndef G4DARKBREM_EVENTLIBRARY_H
+#define G4DARKBREM_EVENTLIBRARY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "G4DarkBreM/ParseLibrary.h"
+
+namespace g4db {
+
+namespace binary {
+class MappedLibrary;
+}
+
+/**
+ * Compact storage of a dark brem event library
+ *
+ * The events are stored as a structure of arrays: the sorted incident
+ * energies, the offset of the first event of each incident energy,
+ * and one contiguous column for each kinematic quantity. The incident
+ * energy is not repeated for each event and columns that are not needed
+ * can be left out entirely, so this is much smaller than the
+ * std::map of OutgoingKinematics returned by parseLibrary.
+ *
+ * This is the same layout as the binary library format, so the storage
+ * can either be owned by this object (built from a parsed library) or
+ * be a memory-mapped binary library.
+ *
+ * Only the memory held once a text library is loaded is reduced. Text
+ * libraries are still parsed into the std::map first and then copied,
+ * so the peak memory while loading one is the parsed library plus the
+ * kept columns. Converting the library to the binary format with
+ * g4db-extract-library avoids that peak since nothing is parsed.
+ */
+class EventLibrary {
+ public:
+  /**
+   * The kinematic quantities stored for each event in the library
+   *
+   * These are the same quantities (in the same order) as the
+   * columns of the CSV format after the incident energy.
+   */
+  enum Column {
+    /// total energy of the recoil lepton
+    RecoilE = 0,
+    /// x-component of recoil lepton momentum
+    RecoilPx,
+    /// y-component of recoil lepton momentum
+    RecoilPy,
+    /// z-component of recoil lepton momentum
+    RecoilPz,
+    /// total energy of the center of momentum
+    CenterE,
+    /// x-component of the center of momentum
+    CenterPx,
+    /// y-component of the center of momentum
+    CenterPy,
+    /// z-component of the center of momentum
+    CenterPz,
+    /// number of columns, not an actual column
+    NColumns
+  };
+
+  /// mask including all of the columns
+  static const unsigned int ALL_COLUMNS{(1u << NColumns) - 1};
+
+  /**
+   * Copy a parsed library into compact storage
+   *
+   * Both the parsed library and the copy are in memory until the
+   * caller releases the parsed library.
+   *
+   * @param[in] lib parsed library to copy
+   * @param[in] column_mask bit mask of the columns to keep, the bit
+   * `1 << c` is set if column `c` should be kept
+   */
+  EventLibrary(const std::map<double, std::vector<OutgoingKinematics>>& lib,
+               unsigned int column_mask = ALL_COLUMNS);
+
+  /**
+   * Memory-map a binary library
+   *
+   * All of the columns are available from a binary library.
+   *
+   * @throws std::runtime_error if the binary library cannot be mapped
+   * @param[in] binary_path path to binary library
+   */
+  EventLibrary(const std::string& binary_path);
+
+  /**
+   * Destructor, unmapping the binary library if it was mapped
+   */
+  ~EventLibrary();
+
+  /// number of incident energies in the library
+  std::size_t numEnergies() const { return n_energies_; }
+
+  /// total number of events in the library
+  std::size_t numEvents() const { return offsets_[n_energies_]; }
+
+  /// sorted array of incident energies [GeV]
+  const double* energies() const { return energies_; }
+
+  /**
+   * Find the incident energy to sample from for the input energy
+   *
+   * This is the closest incident energy strictly above the input
+   * energy or the maximum incident energy if the input energy is
+   * at or above it. The sorted energies are binary searched, so this
+   * is logarithmic in the number of incident energies.
+   *
+   * The returned index is a handle to both the events of that
+   * incident energy and any per-energy state kept by the caller.
+   *
+   * @param[in] energy incident energy [GeV]
+   * @return index of the incident energy to sample from
+   */
+  std::size_t findEnergy(double energy) const {
+    std::size_t i = std::upper_bound(energies_, energies_+n_energies_, energy) - energies_;
+    return i < n_energies_ ? i : n_energies_-1;
+  }
+
+  /**
+   * Number of events for the input energy
+   *
+   * @param[in] i_energy index of the incident energy
+   * @return number of events at that incident energy
+   */
+  std::size_t numEvents(std::size_t i_energy) const {
+    return offsets_[i_energy+1] - offsets_[i_energy];
+  }
+
+  /**
+   * Offset of the first event of the input energy
+   *
+   * Per-event data kept by the caller can use the same layout as
+   * the columns with this offset.
+   *
+   * @param[in] i_energy index of the incident energy
+   * @return index of the first event of that energy in the columns
+   */
+  std::size_t offset(std::size_t i_energy) const { return offsets_[i_energy]; }
+
+  /**
+   * Check if a column is available
+   *
+   * @param[in] c column to check
+   * @return true if the column is stored
+   */
+  bool hasColumn(Column c) const { return columns_[c] != nullptr; }
+
+  /**
+   * Get the values of a column for the input energy
+   *
+   * @param[in] c column to get
+   * @param[in] i_energy index of the incident energy
+   * @return pointer to the first value of that column for the energy,
+   * nullptr if the column is not stored
+   */
+  const double* column(Column c, std::size_t i_energy) const {
+    return columns_[c] ? columns_[c] + offsets_[i_energy] : nullptr;
+  }
+
+  /**
+   * Get an event from the library
+   *
+   * This does no bounds checking and does not allocate any memory.
+   * Columns that are not stored are set to zero.
+   *
+   * @param[in] i_energy index of the incident energy
+   * @param[in] i_event index of the event within that incident energy
+   * @return kinematics of that event
+   */
+  OutgoingKinematics at(std::size_t i_energy, std::size_t i_event) const {
+    std::size_t i = offsets_[i_energy] + i_event;
+    OutgoingKinematics ok;
+    ok.E = energies_[i_energy];
+    ok.lepton = CLHEP::HepLorentzVector(get(RecoilPx, i), get(RecoilPy, i),
+                                        get(RecoilPz, i), get(RecoilE, i));
+    ok.centerMomentum = CLHEP::HepLorentzVector(get(CenterPx, i), get(CenterPy, i),
+                                                get(CenterPz, i), get(CenterE, i));
+    return ok;
+  }
+
+  /**
+   * Total size of the stored library in bytes
+   *
+   * For a memory-mapped library, this is the size of the file which
+   * is only brought into memory as it is accessed.
+   */
+  std::size_t size() const;
+
+ private:
+  /// no copying since we may own a mapping
+  EventLibrary(const EventLibrary&);
+  /// no assignment since we may own a mapping
+  EventLibrary& operator=(const EventLibrary&);
+
+  /// get a value from a column, zero if the column is not stored
+  double get(Column c, std::size_t i) const {
+    return columns_[c] ? columns_[c][i] : 0.;
+  }
+
+ private:
+  /// storage of energies when built from a parsed library
+  std::vector<double> energies_storage_;
+  /// storage of offsets when built from a parsed library
+  std::vector<std::uint64_t> offsets_storage_;
+  /// storage of columns when built from a parsed library
+  std::vector<double> columns_storage_;
+  /// mapped binary library
+  std::unique_ptr<binary::MappedLibrary> mapped_;
+  /// number of incident energies
+  std::size_t n_energies_;
+  /// incident energies
+  const double* energies_;
+  /// offsets of first event for each energy, one more than the energies
+  const std::uint64_t* offsets_;
+  /// start of each column, nullptr for columns that are not stored
+  const double* columns_[NColumns];
+};  // EventLibrary
+
+}  // namespace g4db
+
+#endif
@@ -1,12 +1,21 @@
 #ifndef G4DARKBREM_G4DARKBREMMODEL_H
 #define G4DARKBREM_G4DARKBREMMODEL_H
 
+#include <cstdint>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "G4DarkBreM/ParseLibrary.h"
+#include "G4DarkBreM/ConcurrentMap.h"
+#include "G4DarkBreM/EventLibrary.h"
+#include "G4DarkBreM/Instrumentation.h"
 #include "G4DarkBreM/PrototypeModel.h"
 
+#include "G4Cache.hh"
+
 
 namespace g4db {
 
@@ -63,9 +72,32 @@ class G4DarkBreMModel : public PrototypeModel {
 
   /**
    * Print the configuration of this model
+   *
+   * The counters are printed as well if instrumentation::ENABLED.
    */
   virtual void PrintInfo() const;
 
+  /**
+   * Print the counters of the work done by this model
+   *
+   * These are the number of cross sections calculated and the wall
+   * time spent calculating them as well as a histogram of the number
+   * of events skipped by the ForwardOnly method before finding one
+   * that stays physical for each vertex.
+   */
+  virtual void PrintCounters() const;
+
+  /**
+   * Describe the parameters that the cross section depends on
+   *
+   * This includes the lepton, the A' mass, the scaling method,
+   * the threshold, and epsilon, as well as the integration of the
+   * muon cross section if it is adaptive.
+   *
+   * @returns single-line string describing the parameters
+   */
+  virtual std::string GetXsecParameters() const;
+
   /**
    * Calculates the cross section per atom in GEANT4 internal units.
    *
@@ -153,6 +185,59 @@ class G4DarkBreMModel : public PrototypeModel {
                                               G4double atomicA,
                                               G4double atomicZ);
 
+  /**
+   * Get the kinetic energy below which the cross section is always zero
+   *
+   * ComputeCrossSectionPerAtom returns zero below the threshold
+   * (and below 1 keV for very light dark photons).
+   *
+   * @returns minimum kinetic energy of a lepton to dark brem [Geant4 energy units]
+   */
+  virtual G4double GetMinimumKineticEnergy() const;
+
+  /**
+   * Choose how the muon cross section is integrated
+   *
+   * By default, the muon cross section is integrated over x and theta
+   * with a fixed rule of MUON_X_NODES by MUON_THETA_NODES Gauss-Legendre
+   * nodes after changing to variables in which the integrand is smooth.
+   * Compared to well-converged integrals for A' masses from 1 MeV to 3 GeV
+   * and muon energies up to 1 TeV, this is accurate to better than 1e-6
+   * with 1000 evaluations of the differential cross section.
+   *
+   * The nested adaptive Gauss-Kronrod integrals used before need 4e4 to
+   * 8e5 evaluations and are accurate to about 1e-5 (up to 1e-3 just above
+   * threshold), so they are only kept for validation.
+   *
+   * @param[in] adaptive true to use the nested adaptive integrals
+   */
+  void SetAdaptiveMuonIntegration(bool adaptive) {
+    adaptive_muon_integration_ = adaptive;
+  }
+
+  /**
+   * Calculate the flux factor chi in the Hyper-Improved WW approximation
+   *
+   * This is the chi used in the electron cross section. The form factor
+   * integration limits are fixed by assuming that the A' takes all of the
+   * lepton's energy at zero angle, so chi only depends on the element and
+   * the incident lepton energy.
+   *
+   * Integrating chi numerically is the most expensive part of an electron
+   * cross section, so by default chi is interpolated from a table for each
+   * element (see ChiTable). The tables for the elements that exist when
+   * the model is constructed are built in the constructor and the tables
+   * for any other elements are built the first time they are needed.
+   *
+   * @param[in] A atomic mass [amu]
+   * @param[in] Z atomic number
+   * @param[in] lepton_e incident lepton total energy [GeV]
+   * @param[in] tabulated interpolate chi from the table if true,
+   * integrate it numerically if false
+   * @return flux factor chi [GeV^2]
+   */
+  double FluxFactorChiHIWW(double A, double Z, double lepton_e, bool tabulated = true);
+
   /**
    * Scale one of the MG events in our library to the input incident 
    * lepton energy.
@@ -176,9 +261,13 @@ class G4DarkBreMModel : public PrototypeModel {
    * keeping the \f$p_T\f$ constant. 
    *
    * If the \f$p_T\f$ is larger than the new energy, that event
-   * is skipped, and a new one is taken from the file. If the loaded library
-   * does not fully represent the range of incident energies being seen
-   * by the simulation, this will occur frequently.
+   * cannot be used. Instead of skipping such events one at a time,
+   * the events of each library energy are indexed by the smallest ratio
+   * of kinetic energies at which they stay physical (see MakeForwardIndex),
+   * so the event is drawn uniformly from the ones that can be used.
+   * If the loaded library does not fully represent the range of incident
+   * energies being seen by the simulation, there may be no usable events
+   * and a warning is printed.
    *
    * With only the kinetic energy fraction and \f$p_T\f$, the sign of
    * the longitudinal momentum \f$p_z\f$ is undetermined. This method
@@ -197,7 +286,8 @@ class G4DarkBreMModel : public PrototypeModel {
    *    energy and the sampled incident energy.
    *
    * After these boosts, the energy of the recoil and its \f$p_T\f$ are
-   * extracted.
+   * extracted. The boosts are done for all of the vertices in a batch at
+   * once with the vectorized cmScaling kernel.
    *
    * ## Undefined
    * Don't scale the MadGraph vertex to the actual energy of the lepton.
@@ -210,6 +300,27 @@ class G4DarkBreMModel : public PrototypeModel {
    */
   G4ThreeVector scale(double incident_energy, double lepton_mass);
 
+  /**
+   * Scale a batch of MadGraph vertices to the same incident energy
+   *
+   * This is the same procedure as the single-vertex scale (which calls this
+   * with a batch of one), except the sampling energy is only looked up once,
+   * the random azimuthal angles are drawn in one call to the random engine,
+   * and the results are written into caller-provided arrays. The vertices
+   * are identical to calling the single-vertex scale `n` times.
+   *
+   * @param[in] incident_energy incident total energy of the lepton [GeV] 
+   * @param[in] lepton_mass mass of incident lepton [GeV]
+   * @param[in] n number of vertices to scale
+   * @param[out] px array of at least n recoil lepton x momenta [MeV]
+   * @param[out] py array of at least n recoil lepton y momenta [MeV]
+   * @param[out] pz array of at least n recoil lepton z momenta [MeV]
+   * @param[out] energy array of at least n recoil lepton total energies [MeV],
+   * not filled if nullptr
+   */
+  void scale(double incident_energy, double lepton_mass, std::size_t n,
+             double* px, double* py, double* pz, double* energy = nullptr);
+
   /**
    * Simulates the emission of a dark photon + lepton
    *
@@ -235,47 +346,105 @@ class G4DarkBreMModel : public PrototypeModel {
    * This function loads the directory of LHE files passed
    * into our in-memory library of events to be sampled from.
    *
-   * @param path path to directory of LHE files
+   * The parsed events are copied into an EventLibrary, keeping only
+   * the columns needed by the scaling method. If the path is a binary
+   * library (see binary::isBinaryLibrary), it is memory-mapped instead
+   * and sampled from in place. Models loading the same library share
+   * a single read-only copy of it.
+   *
+   * In this function, we also update maxIterations_ so that it is equal to the smallest
+   * entry in the library (with a maximum of 10k). This saves time in the situation where
+   * an incorrect library was accidentally used and the simulation is looping through events
+   * attempting to find one that can fit its criteria.
+   *
+   * @param path path to directory of LHE files or library file
    */
   void SetMadGraphDataLibrary(const std::string& path);
 
   /**
-   * Fill vector of currentDataPoints_ with the same number of items as the
-   * madgraph data.
+   * Make the index of events used in the ForwardOnly scaling method
+   *
+   * When scaling, the kinetic energy of the recoil is multiplied by the
+   * ratio \f$r\f$ of the actual incident kinetic energy to the sampled
+   * incident kinetic energy while the \f$p_T\f$ is kept. An event with
+   * recoil energy \f$E\f$ then stays physical if and only if
+   * \f[
+   *   r \geq r_{min} = \frac{\sqrt{p_T^2+m^2}-m}{E-m}
+   * \f]
+   * so we sort the events of each library energy by this \f$r_{min}\f$.
+   * The events that can be used at a given ratio are then the leading
+   * events whose \f$r_{min}\f$ is at or below it, which we find by
+   * binary search.
+   *
+   * This only makes the empty index. The events of an incident energy
+   * are sorted the first time they are sampled by GetForwardBin, so the
+   * startup time and memory do not depend on the size of the library.
+   *
+   * @param[in] lepton_mass mass of the lepton the index is built for [GeV]
+   */
+  void MakeForwardIndex(double lepton_mass);
+
+  /**
+   * Fill this thread's vector of currentDataPoints_ with one item for each
+   * incident energy in the madgraph data.
    *
    * Randomly choose a starting point so that the simulation run isn't dependent
    * on the order of the events as written in the LHE library. The random starting
-   * position is uniformly chosen using G4Uniform() so. The sample function
+   * position is uniformly chosen using G4Uniform() so. The scale function
    * will loop from the last event parsed back to the first event parsed so that
    * the starting position does not matter.
    *
-   * In this function, we also update maxIterations_ so that it is equal to the smallest
-   * entry in the library (with a maximum of 10k). This saves time in the situation where
-   * an incorrect library was accidentally used and the simulation is looping through events
-   * attempting to find one that can fit its criteria.
+   * This is called when the library is loaded and then again by scale
+   * the first time that it is called on a different thread.
    */
   void MakePlaceholders();
 
   /**
-   * Returns MadGraph data given an energy [GeV].
+   * Table of the Hyper-Improved WW chi for one element
    *
-   * Gets the energy fraction and \f$p_T\f$ from the imported LHE data.
-   * incident_energy should be in GeV, returns the sample outgoing kinematics.
-   *
-   * Samples from the closest imported incident energy _above_ the given value
-   * (this helps avoid biasing issues).
+   * The logarithm of chi is tabulated at CHI_POINTS_PER_DECADE points per
+   * decade of incident lepton energy from the lowest energy that can pass
+   * the threshold up through CHI_DECADES decades. Linearly interpolating
+   * the logarithm is accurate to about 1e-4 for A' masses from
+   * 1 MeV to 1 GeV. Energies outside of the table are integrated numerically.
+   */
+  struct ChiTable {
+    /// log of the lowest energy in the table
+    double log_e_min;
+    /// step in log energy between points
+    double log_e_step;
+    /// log of chi at each point
+    std::vector<double> log_chi;
+  };
+
+  /// number of Gauss-Legendre nodes in x for the muon cross section
+  static const int MUON_X_NODES{50};
+
+  /// number of Gauss-Legendre nodes in theta for the muon cross section
+  static const int MUON_THETA_NODES{20};
+
+  /// number of table points per decade of energy
+  static const int CHI_POINTS_PER_DECADE{100};
+
+  /// number of decades of energy the table covers
+  static const int CHI_DECADES{7};
+
+  /**
+   * Get the chi table for the input element, building it if needed
    *
-   * @param incident_energy energy of particle undergoing dark brem [GeV]
-   * @return sample outgoing kinematics
+   * @param[in] A atomic mass [amu]
+   * @param[in] Z atomic number
+   * @return table for that element
    */
-  OutgoingKinematics sample(double incident_energy);
+  const ChiTable& GetChiTable(double A, double Z);
 
  private:
   /**
    * maximum number of iterations to check before giving up on an event
    *
-   * This is only used in the ForwardOnly scaling method and is only
-   * reached if the event library energies are not appropriately matched
+   * This is only used in the ForwardOnly scaling method when scaling
+   * for a different lepton mass than the ForwardIndex was built for
+   * and is only reached if the event library energies are not appropriately matched
    * with the energy range of particles that are existing in the simulation.
    */
   unsigned int maxIterations_{10000};
@@ -297,6 +466,15 @@ class G4DarkBreMModel : public PrototypeModel {
    */
   double epsilon_;
 
+  /**
+   * Mass of the lepton we dark brem off of [GeV]
+   *
+   * This is looked up when the model is constructed so that the
+   * calculations do not go through the particle definitions, which
+   * may not be safe to create from threads that Geant4 doesn't know about.
+   */
+  double lepton_mass_;
+
   /**
    * PDG ID number for the A' (dark photon) as written in the LHE files 
    * being loaded as the dark brem event library.
@@ -351,22 +529,123 @@ class G4DarkBreMModel : public PrototypeModel {
   /**
    * Storage of data from mad graph
    *
-   * Maps incoming lepton energy to various options for outgoing kinematics.
-   * This is a hefty map and is what stores **all** of the events
-   * imported from the LHE library of dark brem events.
+   * This is a hefty object and is what stores **all** of the events
+   * imported from the library of dark brem events. The events are
+   * stored in compact columns sorted by incoming lepton energy
+   * so that we can find the sampling energy that is closest above
+   * the actual incoming energy.
+   *
+   * The library is only read after it is loaded, so it is shared between
+   * all of the models using the same library (e.g. the copies of this model
+   * on the different worker threads of a multi-threaded run).
    */
-  std::map<double, std::vector<OutgoingKinematics> > madGraphData_;
+  std::shared_ptr<const EventLibrary> library_;
 
   /**
-   * Stores a map of current access points to mad graph data.
+   * Stores the current access points to mad graph data.
+   *
+   * Indexed by the position of the incoming lepton energy within
+   * the library, the value is the index of the event within that
+   * energy that we will get the data from next.
    *
-   * Maps incoming lepton energy to the index of the data vector
-   * that we will get the data from.
+   * Each thread has its own access points so that this model
+   * can be used from several threads at once.
+   */
+  G4Cache<std::vector<unsigned int>> currentDataPoints_;
+
+  /**
+   * Scratch space for scaling a batch of vertices
    *
-   * Also sorts the incoming lepton energy so that we can find
-   * the sampling energy that is closest above the actual incoming energy.
+   * The vectors only grow, so after the first few vertices on a thread,
+   * scaling does not allocate any memory.
+   */
+  struct ScaleScratch {
+    /// random numbers drawn for the batch
+    std::vector<double> rand;
+    /// scaled recoil energies from the CMScaling kernel [GeV]
+    std::vector<double> cm_e_acc;
+    /// scaled recoil transverse momenta from the CMScaling kernel [GeV]
+    std::vector<double> cm_pt;
+    /// scaled recoil momentum magnitudes from the CMScaling kernel [GeV]
+    std::vector<double> cm_p;
+  };
+
+  /// scratch space for scale, one for each thread like currentDataPoints_
+  G4Cache<ScaleScratch> scaleScratch_;
+
+  /**
+   * Index of the events of one incident energy for ForwardOnly scaling
    */
-  std::map<double, unsigned int> currentDataPoints_;
+  struct ForwardBin {
+    /// sorted minimum kinetic energy ratio for each event
+    std::vector<double> min_ke_ratio;
+    /// index of the event within its incident energy for each entry
+    std::vector<std::uint32_t> event;
+  };
+
+  /**
+   * Index of the events in the library for ForwardOnly scaling
+   *
+   * The bin of an incident energy is only built the first time a vertex
+   * is sampled from it (see GetForwardBin), so the events of the incident
+   * energies that are never sampled are never read. For a memory-mapped
+   * binary library, they are not even paged into memory.
+   */
+  struct ForwardIndex {
+    /// lepton mass the index was built for [GeV]
+    double lepton_mass;
+    /// bins for each incident energy, set once they are built
+    std::unique_ptr<OnceValue<ForwardBin>[]> bins;
+  };
+
+  /**
+   * The ForwardOnly index for the loaded library
+   *
+   * This is only made when using the ForwardOnly method. Its bins are
+   * only set once, so it is shared between copies of this model and
+   * between threads.
+   */
+  std::shared_ptr<ForwardIndex> forward_index_;
+
+  /**
+   * Get the ForwardOnly index of an incident energy, building it if needed
+   *
+   * This can be called from several threads at once, the bin is only
+   * built by one of them.
+   *
+   * @see MakeForwardIndex for how the events are sorted
+   * @param[in] i_energy index of the incident energy in the library
+   * @return index of the events of that incident energy
+   */
+  const ForwardBin& GetForwardBin(std::size_t i_energy) const;
+
+  /// use the nested adaptive integrals for the muon cross section
+  bool adaptive_muon_integration_{false};
+
+  /// calls to calculate a cross section above threshold and their wall time
+  instrumentation::Timer xsec_timer_;
+
+  /**
+   * number of events skipped for each vertex by the ForwardOnly method
+   *
+   * Only filled without the ForwardOnly index, since the index chooses
+   * among the physical events directly and never skips any.
+   */
+  instrumentation::Histogram forward_only_rejections_;
+
+  /// number of ForwardOnly vertices taken from an unphysical event since no physical one was found
+  instrumentation::Counter forward_only_fallbacks_;
+
+  /**
+   * The chi tables for the elements we have seen, keyed by (A, Z)
+   *
+   * The tables are never removed once they are built, so references
+   * to them stay valid after the lock is released.
+   */
+  std::map<std::pair<double,double>, ChiTable> chi_tables_;
+
+  /// guards chi_tables_ since the cross section may be calculated on several threads
+  std::mutex chi_tables_mutex_;
 };
 
 }  // namespace g4db
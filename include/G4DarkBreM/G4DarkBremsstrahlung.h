@@ -8,8 +8,11 @@
 #ifndef G4DARKBREM_G4DARKBREMSSTRAHLUNG_H_
 #define G4DARKBREM_G4DARKBREMSSTRAHLUNG_H_
 
+#include <vector>
+
 // Geant
 #include "G4VDiscreteProcess.hh"
+#include "G4PhysicsLogVector.hh"
 
 #include "G4DarkBreM/PrototypeModel.h"
 #include "G4DarkBreM/ElementXsecCache.h"
@@ -49,7 +52,7 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
    *
    * @param[in] the_model model to use for dark brem simulation
    * @param[in] muons true if muons are dark bremming, false for electrons
-   * @param[in] only_one_per_event true if de-activating process after first dark brem
+   * @param[in] only_one_per_event true if disabling process for the rest of the event after first dark brem
    * @param[in] global_bias bias xsec globally by this factor
    * @param[in] cache_xsec true if we should cache xsecs at the MeV level of precision
    * @param[in] verbose_level level of verbosity to print for this process and model
@@ -75,10 +78,93 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
   /**
    * Reports the parameters to G4cout.
    *
+   * The counters are reported as well if g4db::instrumentation::ENABLED.
+   *
    * @see G4DarkBremsstrahlungModel::PrintInfo
    */
   virtual void PrintInfo();
 
+  /**
+   * Reports the counters of the work done by this process to G4cout.
+   *
+   * These are the number of calls to GetMeanFreePath (and how many of them
+   * took the fast path), the hits and misses of the cross section cache,
+   * and the number of calls to PostStepDoIt, followed by the counters of
+   * the model. They are only counted if G4DarkBreM is built with the CMake
+   * option G4DARKBREM_INSTRUMENTATION, so they cost nothing otherwise.
+   * The process is separate for each thread, so these are the counts of
+   * this thread and this can be called at the end of a run.
+   *
+   * @see g4db::PrototypeModel::PrintCounters
+   */
+  void PrintCounters() const;
+
+  /**
+   * Use tables of the macroscopic cross section for each material
+   *
+   * By default, the mean free path is calculated on each step by summing the
+   * cross sections of all of the elements in the current material. With this option,
+   * a table of the macroscopic cross section (the sum over elements weighted
+   * by the number of atoms per volume) is built for each material on a log
+   * energy grid when the run is initialized, so the mean free path is one
+   * interpolation no matter how many elements are in the material.
+   *
+   * The tables are calculated from the model directly (not through the cache)
+   * at the energies of the grid and linearly interpolated between them.
+   * Kinetic energies outside of the table range fall back to the sum over elements.
+   * Since the cross section is zero below the threshold, a good minimum energy
+   * is the threshold of the model.
+   *
+   * This needs to be called before the run is initialized.
+   *
+   * @param[in] min_energy minimum kinetic energy of the tables [Geant4 energy units]
+   * @param[in] max_energy maximum kinetic energy of the tables [Geant4 energy units]
+   * @param[in] n_bins number of log-spaced bins in the tables
+   */
+  void UseMaterialTables(G4double min_energy, G4double max_energy, std::size_t n_bins);
+
+  /**
+   * Interpolate the cached cross sections within a grid of energies
+   *
+   * This turns on the cache (if it wasn't already) and configures it
+   * with g4db::ElementXsecCache::interpolate. The grids for all of the
+   * elements are built when the run is initialized so that the first
+   * event is as fast as the rest.
+   *
+   * This needs to be called before the run is initialized.
+   *
+   * @param[in] min_energy minimum kinetic energy of the grids [Geant4 energy units]
+   * @param[in] max_energy maximum kinetic energy of the grids [Geant4 energy units]
+   * @param[in] tolerance target relative accuracy of the interpolation
+   */
+  void InterpolateCache(G4double min_energy, G4double max_energy, double tolerance);
+
+  /**
+   * Warm the cross section cache from a file
+   *
+   * This turns on the cache (if it wasn't already) and loads the
+   * cross sections from a file written by g4db::ElementXsecCache::save
+   * (e.g. by `g4db-xsec-calc --cache`).
+   *
+   * @throws std::runtime_error if the file cannot be read or was calculated
+   * with different model parameters
+   * @param[in] path path to cross section cache file
+   */
+  void LoadXsecCache(const std::string& path);
+
+  /**
+   * Build the tables of macroscopic cross sections
+   *
+   * Called by Geant4 at run initialization. If the cache is interpolating
+   * (see InterpolateCache), the grids for all of the elements are built.
+   * The material tables are only built if UseMaterialTables has been called.
+   * Each element is only calculated once at each energy even if it is in
+   * several materials.
+   *
+   * @param[in] p particle the tables are being built for
+   */
+  virtual void BuildPhysicsTable(const G4ParticleDefinition& p);
+
   /**
    * This is the function actually called by Geant4 that does the dark brem
    * interaction.
@@ -86,11 +172,10 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
    * aParticleChange is a protected member variable of G4VDiscreteProcess
    * that we should edit here.
    *
-   * If only one per event is set, then we deactivate the dark brem process,
-   * ensuring only one dark brem per step and per event.
-   * Reactivated in RunManager::TerminateOneEvent.
+   * If only one per event is set, then we disable the dark brem process
+   * for the rest of the event, ensuring only one dark brem per step and per event.
    *
-   * @see RunManager::TerminateOneEvent
+   * @see StartTracking for where it is enabled again
    * @see G4DarkBremsstrahlungModel::GenerateChange
    * @param[in] track current G4Track that is being stepped
    * @param[in] step current step that just finished
@@ -99,6 +184,17 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
   virtual G4VParticleChange* PostStepDoIt(const G4Track& track,
                                           const G4Step& step);
 
+  /**
+   * Enable the process again if the track is from a new event
+   *
+   * Called by Geant4 at the start of each track of the configured lepton.
+   * This only does something if only one per event is set, in which case
+   * the process is enabled again once the run or event ID changes.
+   *
+   * @param[in] track track that is starting
+   */
+  virtual void StartTracking(G4Track* track);
+
   /**
    * Get a reference to the cross section cache.
    *
@@ -108,6 +204,18 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
    */
   g4db::ElementXsecCache& getCache() { return element_xsec_cache_; }
 
+  /**
+   * Get the number of steps that skipped calculating the cross section
+   *
+   * These are the steps where GetMeanFreePath returned DBL_MAX right away
+   * because the track is not the configured lepton or its kinetic energy
+   * is below the minimum of the model. The process is separate for each
+   * thread, so this only counts the steps of this thread.
+   *
+   * @returns number of steps that took the fast path
+   */
+  std::size_t GetNumFastPathSteps() const { return n_fast_path_steps_; }
+
  protected:
   /**
    * Calculate the mean free path given the input conditions
@@ -130,12 +238,27 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
    *
    * We maintain a cache for the cross sections calculated by the model
    * so that later in the run it is less likely that the model will
-   * need to be called to calculate the cross section. This is done
+   * need to be called to calculate the cross section. The cache is
+   * shared with the processes of the other threads, so each cross
+   * section is only calculated once per program. This is done
    * in order to attempt to improve speed of simulation and avoid
    * repetition of the same, deterministic calculations.
    * If you want to turn off the cache-ing behavior, set `cache_xsec` to false
    * in the constructor.
    *
+   * If there has already been a dark brem in this event and only one per
+   * event is set, DBL_MAX is returned so the process does not happen again.
+   *
+   * Steps of tracks with a kinetic energy below the minimum of the model
+   * (PrototypeModel::GetMinimumKineticEnergy) return DBL_MAX before
+   * touching the material or the cache since the cross section is zero.
+   * These are counted along with steps of tracks that are not applicable
+   * (see GetNumFastPathSteps).
+   *
+   * If UseMaterialTables has been called, the total cross section is instead
+   * interpolated from the table for the current material when the energy
+   * is within the range of the tables.
+   *
    * If the total cross section is above DBL_MIN, then it is inverted to
    * obtain the mean free path. Otherwise, DBL_MAX is returned.
    *
@@ -159,15 +282,21 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
   /**
    * Only allow the dark brem to happen once per event.
    *
-   * This allows for the dark brem process to be de-activated when
-   * SampleSecondaries is called.
-   *
-   * @note If a user wants to use this option, the dark brem process
-   * should be _always_ re-activated at the end of each event.
-   * This reactivation has no effect when the process is already active.
+   * This allows for the dark brem process to be disabled when
+   * PostStepDoIt is called. It is enabled again in StartTracking
+   * once a new event starts, so the user does not need to do anything.
    */
   bool only_one_per_event_;
 
+  /// has there been a dark brem in the current event? only set if only_one_per_event_
+  bool brem_this_event_{false};
+
+  /// ID of the event of the last track that started
+  G4int event_id_{-1};
+
+  /// ID of the run of the last track that started
+  G4int run_id_{-1};
+
   /**
    * Bias the dark brem cross section GLOBALLY
    */
@@ -187,6 +316,33 @@ class G4DarkBremsstrahlung : public G4VDiscreteProcess {
 
   /// Our instance of a cross section cache
   g4db::ElementXsecCache element_xsec_cache_;
+
+  /// kinetic energy below which the cross section of the model is zero
+  G4double min_kinetic_energy_;
+
+  /// number of steps where GetMeanFreePath returned without calculating
+  std::size_t n_fast_path_steps_{0};
+
+  /// number of calls to GetMeanFreePath
+  g4db::instrumentation::Counter n_mean_free_path_calls_;
+
+  /// number of calls to PostStepDoIt
+  g4db::instrumentation::Counter n_post_step_calls_;
+
+  /// Should we build and use the tables of macroscopic cross sections?
+  bool use_material_tables_{false};
+
+  /// minimum kinetic energy of the tables
+  G4double table_min_energy_{0.};
+
+  /// maximum kinetic energy of the tables
+  G4double table_max_energy_{0.};
+
+  /// number of bins in the tables
+  std::size_t table_n_bins_{0};
+
+  /// macroscopic cross section tables indexed by material index
+  std::vector<std::unique_ptr<G4PhysicsLogVector>> material_tables_;
 };  // G4DarkBremsstrahlung
 
 #endif
@@ -0,0 +1,201 @@
+/**
+ * @file Instrumentation.h
+ * Declaration and definition of the counters of the work done by dark brem
+ */
+
+#ifndef G4DARKBREM_INSTRUMENTATION_H
+#define G4DARKBREM_INSTRUMENTATION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace g4db {
+
+/**
+ * counters of the work done by the dark brem process and model
+ *
+ * The counters only count when G4DarkBreM is built with the CMake option
+ * G4DARKBREM_INSTRUMENTATION, which defines the preprocessor macro of the
+ * same name for G4DarkBreM and everything linking to it. Otherwise, ENABLED
+ * is false and every call that would change a counter is an empty inline
+ * function that the compiler removes, so the hot paths are not changed.
+ *
+ * The counters are atomic so that they stay correct if an object holding
+ * them is used from several threads. Each count is independent of the
+ * others, so the relaxed memory order is enough.
+ */
+namespace instrumentation {
+
+#ifdef G4DARKBREM_INSTRUMENTATION
+/// are the counters counting?
+static const bool ENABLED{true};
+#else
+/// are the counters counting?
+static const bool ENABLED{false};
+#endif
+
+/**
+ * A count of something that happened
+ */
+class Counter {
+ public:
+  /// start at zero
+  Counter() : n_{0} {}
+
+  /// copy the current count
+  Counter(const Counter& c) : n_{c.get()} {}
+
+  /// copy the current count
+  Counter& operator=(const Counter& c) {
+    n_.store(c.get(), std::memory_order_relaxed);
+    return *this;
+  }
+
+  /**
+   * Add to the count
+   *
+   * @param[in] k number to add
+   */
+  void add(std::uint64_t k = 1) {
+    if (ENABLED) n_.fetch_add(k, std::memory_order_relaxed);
+  }
+
+  /// current count
+  std::uint64_t get() const { return n_.load(std::memory_order_relaxed); }
+
+ private:
+  /// the count
+  std::atomic<std::uint64_t> n_;
+};  // Counter
+
+/**
+ * The number of calls to something and the total wall time spent in them
+ */
+class Timer {
+ public:
+  /// clock measuring the wall time
+  typedef std::chrono::steady_clock clock;
+
+  /**
+   * Time a scope, adding it to the timer when the scope ends
+   */
+  class Scope {
+   public:
+    /**
+     * Start timing
+     *
+     * @param[in] t timer to add to
+     */
+    explicit Scope(Timer& t) : timer_(t) {
+      if (ENABLED) start_ = clock::now();
+    }
+
+    /// stop timing and add to the timer
+    ~Scope() {
+      if (ENABLED) timer_.add(clock::now() - start_);
+    }
+
+   private:
+    /// timer to add to
+    Timer& timer_;
+    /// when the scope started
+    clock::time_point start_;
+  };  // Scope
+
+  /**
+   * Add a call to the timer
+   *
+   * @param[in] elapsed wall time spent in the call
+   */
+  void add(clock::duration elapsed) {
+    calls_.add();
+    nanoseconds_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  /// number of calls timed
+  std::uint64_t calls() const { return calls_.get(); }
+
+  /// total wall time of the calls [s]
+  double seconds() const { return nanoseconds_.get()*1e-9; }
+
+ private:
+  /// number of calls timed
+  Counter calls_;
+  /// total wall time of the calls [ns]
+  Counter nanoseconds_;
+};  // Timer
+
+/**
+ * A histogram of counts with bins doubling in width
+ *
+ * The first bin holds zero and then bin i holds the values from
+ * 2^(i-1) up to 2^i - 1, with the last bin also holding everything
+ * above it.
+ */
+class Histogram {
+ public:
+  /// number of bins
+  static const std::size_t NBINS{16};
+
+  /**
+   * Count a value
+   *
+   * @param[in] value value to put into its bin
+   */
+  void fill(std::uint64_t value) {
+    if (not ENABLED) return;
+    std::size_t bin{0};
+    while (value > 0 and bin+1 < NBINS) {
+      value >>= 1;
+      bin++;
+    }
+    bins_[bin].add();
+  }
+
+  /**
+   * Count in a bin
+   *
+   * @param[in] bin index of bin
+   * @return number of values in the bin
+   */
+  std::uint64_t count(std::size_t bin) const { return bins_[bin].get(); }
+
+  /**
+   * Smallest value in a bin
+   *
+   * @param[in] bin index of bin
+   * @return smallest value that goes into the bin
+   */
+  static std::uint64_t low(std::size_t bin) {
+    return bin == 0 ? 0 : std::uint64_t(1) << (bin-1);
+  }
+
+  /**
+   * Print the non-empty bins, one per line
+   *
+   * @param[in,out] o stream to print to
+   * @param[in] indent indentation of each line
+   */
+  void print(std::ostream& o, const std::string& indent) const {
+    for (std::size_t bin{0}; bin < NBINS; bin++) {
+      if (count(bin) == 0) continue;
+      o << indent << low(bin);
+      if (bin+1 == NBINS) o << "+";
+      else if (bin > 1) o << "-" << low(bin+1)-1;
+      o << " : " << count(bin) << "\n";
+    }
+  }
+
+ private:
+  /// counts in the bins
+  Counter bins_[NBINS];
+};  // Histogram
+
+}  // namespace instrumentation
+}  // namespace g4db
+
+#endif
@@ -31,10 +31,20 @@ struct OutgoingKinematics {
 /**
  * parse the input library and return the in-memory kinematics library
  *
+ * Binary libraries (see binary::write) are also accepted and are copied
+ * into the in-memory library.
+ *
+ * If the path is a directory, the files within it are parsed in parallel
+ * on up to `n_threads` threads. The resulting library is the same
+ * no matter how many threads are used.
+ *
  * @param[in] path path to library to parse
+ * @param[in] aprime_lhe_id ID number of the dark photon within the LHE files
  * @param[in,out] lib map of incident energy keys to set of outgoing kinematics
+ * @param[in] n_threads maximum number of threads to use when parsing a directory
  */
-void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, std::vector<OutgoingKinematics>>& lib);
+void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, std::vector<OutgoingKinematics>>& lib,
+    unsigned int n_threads = 1);
 
 /**
  * Dump the input library to the input output stream
@@ -12,6 +12,9 @@
 #include "G4Step.hh"
 #include "G4ParticleChange.hh"
 
+#include <stdexcept>
+#include <string>
+
 /**
  * G4DarkBreM internal namespace
  */
@@ -86,6 +89,16 @@ class PrototypeModel {
    */
   virtual void PrintInfo() const = 0;
 
+  /**
+   * Print the counters of the work done by this model
+   *
+   * Only models that count their work print anything and they
+   * only count it if instrumentation::ENABLED.
+   *
+   * @see G4DarkBremsstrahlung::PrintCounters
+   */
+  virtual void PrintCounters() const {}
+
   /**
    * Calculate the cross section given the input parameters
    *
@@ -99,6 +112,34 @@ class PrototypeModel {
                                               G4double atomicA,
                                               G4double atomicZ) = 0;
 
+  /**
+   * Get the kinetic energy below which the cross section is always zero
+   *
+   * The process uses this to skip calculating the mean free path for the
+   * many low-energy leptons in a shower. The default of zero means that
+   * the cross section is always calculated.
+   *
+   * @see G4DarkBremsstrahlung::GetMeanFreePath
+   * @returns minimum kinetic energy of a lepton to dark brem [Geant4 energy units]
+   */
+  virtual G4double GetMinimumKineticEnergy() const { return 0.; }
+
+  /**
+   * Describe the parameters that the cross section depends on
+   *
+   * This is used to identify the model that calculated a persisted cross section
+   * cache so that the cache is not loaded by a model with different parameters.
+   * The default implementation throws since it does not know the parameters
+   * of the derived model.
+   *
+   * @see ElementXsecCache::load
+   * @throws std::runtime_error if the model does not support persisted caches
+   * @returns single-line string describing the parameters
+   */
+  virtual std::string GetXsecParameters() const {
+    throw std::runtime_error("This dark brem model does not support persisted cross section caches.");
+  }
+
   /**
    * Generate the change in the particle now that we can assume the interaction
    * is occuring
@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "G4DarkBreM/BinaryLibrary.h"
+
+namespace g4db {
+namespace binary {
+
+const std::string EXTENSION{".g4dbl"};
+
+/// the magic bytes at the start of every binary library
+static const char MAGIC[8] = {'G','4','D','B','L','I','B','\0'};
+
+/// integer written into the header to check the byte order on read
+static const std::uint32_t BYTE_ORDER_MARK{0x01020304};
+
+/// header is padded to this many bytes so the sections after it are aligned
+static const std::uint64_t HEADER_SIZE{64};
+
+static_assert(sizeof(Header) <= HEADER_SIZE, "Binary library header larger than its padding.");
+
+/**
+ * Check that a section of the file lies within it
+ *
+ * The number of elements is bounded by the space left after the offset
+ * before multiplying, so a corrupt count cannot overflow past the check.
+ *
+ * @param[in] offset byte offset of the section
+ * @param[in] count number of elements in the section
+ * @param[in] element_size size of one element in bytes
+ * @param[in] size size of the file in bytes
+ * @return true if the section is within the file and aligned for its elements
+ */
+static bool sectionFits(std::uint64_t offset, std::uint64_t count,
+                        std::uint64_t element_size, std::uint64_t size) {
+  return offset <= size and offset % element_size == 0
+         and count <= (size - offset) / element_size;
+}
+
+bool isBinaryLibrary(const std::string& path) {
+  return path.length() >= EXTENSION.length() and
+    path.compare(path.length() - EXTENSION.length(), EXTENSION.length(), EXTENSION) == 0;
+}
+
+void write(const std::string& path, const std::map<double, std::vector<OutgoingKinematics>>& lib) {
+  std::vector<double> energies;
+  std::vector<std::uint64_t> offsets{0};
+  for (const auto& lib_entry : lib) {
+    energies.push_back(lib_entry.first);
+    offsets.push_back(offsets.back() + lib_entry.second.size());
+  }
+
+  Header header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.n_columns = EventLibrary::NColumns;
+  header.n_energies = energies.size();
+  header.n_events = offsets.back();
+  header.energies_offset = HEADER_SIZE;
+  header.events_offset = header.energies_offset + sizeof(double)*energies.size();
+  header.columns_offset = header.events_offset + sizeof(std::uint64_t)*offsets.size();
+
+  std::ofstream f{path, std::ios::binary};
+  if (not f.is_open()) {
+    throw std::runtime_error("Unable to open '"+path+"' for writing.");
+  }
+
+  char padded_header[HEADER_SIZE] = {0};
+  std::memcpy(padded_header, &header, sizeof(Header));
+  f.write(padded_header, HEADER_SIZE);
+  f.write(reinterpret_cast<const char*>(energies.data()), sizeof(double)*energies.size());
+  f.write(reinterpret_cast<const char*>(offsets.data()), sizeof(std::uint64_t)*offsets.size());
+
+  /**
+   * We write one column at a time, buffering the values of a single
+   * column so that we are not writing one double at a time.
+   */
+  std::vector<double> column;
+  column.reserve(header.n_events);
+  for (int c{0}; c < EventLibrary::NColumns; c++) {
+    column.clear();
+    for (const auto& lib_entry : lib) {
+      for (const auto& sample : lib_entry.second) {
+        switch (c) {
+          case EventLibrary::RecoilE : column.push_back(sample.lepton.e()); break;
+          case EventLibrary::RecoilPx: column.push_back(sample.lepton.px()); break;
+          case EventLibrary::RecoilPy: column.push_back(sample.lepton.py()); break;
+          case EventLibrary::RecoilPz: column.push_back(sample.lepton.pz()); break;
+          case EventLibrary::CenterE : column.push_back(sample.centerMomentum.e()); break;
+          case EventLibrary::CenterPx: column.push_back(sample.centerMomentum.px()); break;
+          case EventLibrary::CenterPy: column.push_back(sample.centerMomentum.py()); break;
+          case EventLibrary::CenterPz: column.push_back(sample.centerMomentum.pz()); break;
+        }
+      }
+    }
+    f.write(reinterpret_cast<const char*>(column.data()), sizeof(double)*column.size());
+  }
+
+  f.close();
+  if (not f) {
+    throw std::runtime_error("Error while writing binary library to '"+path+"'.");
+  }
+}
+
+MappedLibrary::MappedLibrary(const std::string& path)
+  : mapping_{nullptr}, size_{0}, header_{nullptr}, energies_{nullptr}, offsets_{nullptr} {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open binary library '"+path+"'.");
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 or st.st_size < static_cast<off_t>(HEADER_SIZE)) {
+    ::close(fd);
+    throw std::runtime_error("Binary library '"+path+"' is too small to be a library.");
+  }
+  size_ = st.st_size;
+  mapping_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after the file descriptor is closed
+  ::close(fd);
+  if (mapping_ == MAP_FAILED) {
+    mapping_ = nullptr;
+    throw std::runtime_error("Unable to memory-map binary library '"+path+"'.");
+  }
+  /*
+   * the events of an incident energy are only read once it is sampled,
+   * so we ask the kernel not to read ahead of the pages that are touched
+   * and only the incident energies in use are paged into memory
+   */
+  ::madvise(mapping_, size_, MADV_RANDOM);
+
+  /**
+   * We validate the header and the sizes of the sections before
+   * handing out any pointers into the mapping. Since the constructor
+   * throwing means the destructor will not be called, we need to
+   * unmap on failure ourselves.
+   */
+  header_ = static_cast<const Header*>(mapping_);
+  std::string err;
+  if (std::memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0) {
+    err = "is not a binary dark brem library";
+  } else if (header_->byte_order != BYTE_ORDER_MARK) {
+    err = "was written on a machine with a different byte order";
+  } else if (header_->version != VERSION) {
+    err = "has version "+std::to_string(header_->version)
+          +" but only version "+std::to_string(VERSION)+" is supported";
+  } else if (header_->n_columns != EventLibrary::NColumns) {
+    err = "does not have the expected number of columns";
+  } else if (header_->n_energies >= size_ / sizeof(double)
+      or header_->n_events > size_ / (sizeof(double)*EventLibrary::NColumns)
+      or not sectionFits(header_->energies_offset, header_->n_energies, sizeof(double), size_)
+      or not sectionFits(header_->events_offset, header_->n_energies+1, sizeof(std::uint64_t), size_)
+      or not sectionFits(header_->columns_offset, EventLibrary::NColumns*header_->n_events,
+                         sizeof(double), size_)) {
+    err = "is truncated";
+  }
+
+  if (err.empty()) {
+    const char* base = static_cast<const char*>(mapping_);
+    energies_ = reinterpret_cast<const double*>(base + header_->energies_offset);
+    offsets_ = reinterpret_cast<const std::uint64_t*>(base + header_->events_offset);
+    for (int c{0}; c < EventLibrary::NColumns; c++) {
+      columns_[c] = reinterpret_cast<const double*>(base + header_->columns_offset)
+                    + c*header_->n_events;
+    }
+    /*
+     * the offsets are the only thing the accessors index the columns with,
+     * so they must not decrease or the number of events of an energy underflows
+     */
+    if (offsets_[0] != 0 or offsets_[header_->n_energies] != header_->n_events) {
+      err = "has an inconsistent energy index";
+    }
+    for (std::uint64_t i{0}; err.empty() and i < header_->n_energies; i++) {
+      if (offsets_[i+1] < offsets_[i]) err = "has an inconsistent energy index";
+    }
+  }
+
+  if (not err.empty()) {
+    ::munmap(mapping_, size_);
+    throw std::runtime_error("Binary library '"+path+"' "+err+".");
+  }
+}
+
+MappedLibrary::~MappedLibrary() {
+  if (mapping_) ::munmap(mapping_, size_);
+}
+
+void MappedLibrary::fill(std::map<double, std::vector<OutgoingKinematics>>& lib) const {
+  for (std::size_t i_energy{0}; i_energy < numEnergies(); i_energy++) {
+    auto& events = lib[energies_[i_energy]];
+    events.reserve(events.size() + numEvents(i_energy));
+    for (std::size_t i_event{0}; i_event < numEvents(i_energy); i_event++) {
+      events.push_back(at(i_energy, i_event));
+    }
+  }
+}
+
+}  // namespace binary
+}  // namespace g4db
@@ -0,0 +1,102 @@
+#include "G4DarkBreM/CMScaling.h"
+
+#include <cmath>
+
+/**
+ * Attribute to compile a function for several instruction sets
+ *
+ * The dynamic loader picks the version matching the machine we are
+ * running on, so the library can be built for the baseline instruction
+ * set and still use the wide vector units where they are available.
+ * This relies on ifunc support, so we only use it on x86-64 Linux.
+ */
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define G4DARKBREM_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef G4DARKBREM_TARGET_CLONES
+#define G4DARKBREM_TARGET_CLONES
+#endif
+
+namespace g4db {
+
+/**
+ * Boost a four-vector by the input velocity
+ *
+ * This is CLHEP::HepLorentzVector::boost written out component-wise
+ * so it can be inlined into a vectorized loop.
+ *
+ * @param[in] bx x-component of velocity
+ * @param[in] by y-component of velocity
+ * @param[in] bz z-component of velocity
+ * @param[in,out] x x-component of four-vector
+ * @param[in,out] y y-component of four-vector
+ * @param[in,out] z z-component of four-vector
+ * @param[in,out] t time-component of four-vector
+ */
+static inline void boost(double bx, double by, double bz,
+                         double& x, double& y, double& z, double& t) {
+  double b2 = bx*bx + by*by + bz*bz;
+  double ggamma = 1.0 / std::sqrt(1.0 - b2);
+  double bp = bx*x + by*y + bz*z;
+  /*
+   * CLHEP calculates (ggamma - 1)/b2 and checks that b2 is not zero,
+   * but that check is a branch in the loop which stops it from being
+   * vectorized. This form is equal, finite at b2 == 0 (where it is
+   * multiplied by bp == 0 anyway), and avoids the cancellation
+   * in (ggamma - 1) for slow boosts.
+   */
+  double gamma2 = ggamma*ggamma/(ggamma + 1.0);
+  x = x + gamma2*bp*bx + ggamma*bx*t;
+  y = y + gamma2*bp*by + ggamma*by*t;
+  z = z + gamma2*bp*bz + ggamma*bz*t;
+  t = ggamma*(t + bp);
+}
+
+/**
+ * The loop of cmScaling over the columns
+ *
+ * All of the pointers are marked as not aliasing each other. Otherwise,
+ * the compiler would need to check that none of the outputs overlap any
+ * of the inputs before running the vectorized loop and it gives up
+ * on vectorizing when there are this many checks.
+ */
+G4DARKBREM_TARGET_CLONES
+static void cmScalingLoop(std::size_t n,
+    const double* __restrict recoil_e, const double* __restrict recoil_px,
+    const double* __restrict recoil_py, const double* __restrict recoil_pz,
+    const double* __restrict center_e, const double* __restrict center_px,
+    const double* __restrict center_py, const double* __restrict center_pz,
+    double ediff, double lepton_mass, double ke_ratio,
+    double* __restrict e_acc, double* __restrict pt, double* __restrict p) {
+  for (std::size_t i{0}; i < n; i++) {
+    double x{recoil_px[i]}, y{recoil_py[i]}, z{recoil_pz[i]}, t{recoil_e[i]};
+
+    // out of the library's CoM frame
+    double inv_e = 1./center_e[i];
+    boost(-center_px[i]*inv_e, -center_py[i]*inv_e, -center_pz[i]*inv_e, x, y, z, t);
+
+    // into the CoM frame shifted to the incident energy
+    double inv_new_e = 1./(center_e[i] - ediff);
+    boost(center_px[i]*inv_new_e, center_py[i]*inv_new_e, (center_pz[i] - ediff)*inv_new_e,
+          x, y, z, t);
+
+    e_acc[i] = (recoil_e[i] - lepton_mass) * ke_ratio + lepton_mass;
+    pt[i] = std::sqrt(x*x + y*y);
+    p[i] = std::sqrt(x*x + y*y + z*z);
+  }
+}
+
+void cmScaling(std::size_t n, const double* const columns[EventLibrary::NColumns],
+               double sample_energy, double incident_energy, double lepton_mass,
+               double ke_ratio, double* e_acc, double* pt, double* p) {
+  cmScalingLoop(n,
+      columns[EventLibrary::RecoilE], columns[EventLibrary::RecoilPx],
+      columns[EventLibrary::RecoilPy], columns[EventLibrary::RecoilPz],
+      columns[EventLibrary::CenterE], columns[EventLibrary::CenterPx],
+      columns[EventLibrary::CenterPy], columns[EventLibrary::CenterPz],
+      sample_energy - incident_energy, lepton_mass, ke_ratio, e_acc, pt, p);
+}
+
+}  // namespace g4db
@@ -1,25 +1,310 @@
 #include "G4DarkBreM/ElementXsecCache.h"
 
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
 namespace g4db {
 
+/**
+ * The cross sections of one element at each MeV of energy
+ *
+ * The energies are split into blocks which are only allocated once an
+ * energy in them is requested, so an element only takes up memory
+ * for the range of energies that is actually used.
+ */
+class ElementXsecCache::EnergyTable {
+ public:
+  /// no blocks allocated yet
+  EnergyTable() : blocks_{new std::atomic<Block*>[N_BLOCKS]} {
+    for (key_t i{0}; i < N_BLOCKS; i++) blocks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  /// delete the allocated blocks
+  ~EnergyTable() {
+    for (key_t i{0}; i < N_BLOCKS; i++) delete blocks_[i].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Find the cross section at an energy
+   *
+   * @param[in] energy energy [MeV], below MAX_E
+   * @return pointer to the cross section, nullptr if it isn't calculated yet
+   */
+  const G4double* find(key_t energy) const {
+    const Block* b{blocks_[energy / BLOCK_SIZE].load(std::memory_order_acquire)};
+    return b ? b->xsecs[energy % BLOCK_SIZE].get() : nullptr;
+  }
+
+  /**
+   * Get the entry for an energy, allocating its block if needed
+   *
+   * @param[in] energy energy [MeV], below MAX_E
+   * @return entry for the cross section at that energy
+   */
+  OnceValue<G4double>& at(key_t energy) {
+    std::atomic<Block*>& block{blocks_[energy / BLOCK_SIZE]};
+    Block* b{block.load(std::memory_order_acquire)};
+    if (not b) {
+      Block* allocated = new Block;
+      if (block.compare_exchange_strong(b, allocated, std::memory_order_acq_rel)) {
+        b = allocated;
+      } else {
+        delete allocated;
+      }
+    }
+    return b->xsecs[energy % BLOCK_SIZE];
+  }
+
+  /**
+   * Call the input function for each calculated cross section in order of energy
+   *
+   * @param[in] f function called with the energy [MeV] and the cross section
+   */
+  template <typename F>
+  void forEach(F f) const {
+    for (key_t i_block{0}; i_block < N_BLOCKS; i_block++) {
+      const Block* b{blocks_[i_block].load(std::memory_order_acquire)};
+      if (not b) continue;
+      for (key_t i{0}; i < BLOCK_SIZE; i++) {
+        const G4double* xsec{b->xsecs[i].get()};
+        if (xsec) f(i_block*BLOCK_SIZE + i, *xsec);
+      }
+    }
+  }
+
+ private:
+  /// number of energies in a block
+  static const key_t BLOCK_SIZE{1024};
+
+  /// number of blocks to cover all of the energies below MAX_E
+  static const key_t N_BLOCKS{MAX_E/BLOCK_SIZE + 1};
+
+  /// a block of cross sections at consecutive energies
+  struct Block {
+    /// cross sections, set once they are calculated
+    OnceValue<G4double> xsecs[BLOCK_SIZE];
+  };
+
+  /// no copying since the blocks are owned
+  EnergyTable(const EnergyTable&);
+  /// no assignment since the blocks are owned
+  EnergyTable& operator=(const EnergyTable&);
+
+ private:
+  /// pointers to the blocks, nullptr for blocks that are not allocated yet
+  std::unique_ptr<std::atomic<Block*>[]> blocks_;
+};  // EnergyTable
+
+/**
+ * Get the storage shared by all of the caches with the input identifier
+ *
+ * The storage is kept alive by the caches using it, so a new one is
+ * made once all of the caches with an identifier have been destroyed.
+ *
+ * @tparam T type of value stored
+ * @param[in] id identifier of the storage
+ * @return storage shared with the other caches with this identifier
+ */
+template <typename T>
+static std::shared_ptr<ConcurrentMap<T>> sharedStorage(const std::string& id) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::weak_ptr<ConcurrentMap<T>>> registry;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::weak_ptr<ConcurrentMap<T>>& entry{registry[id]};
+  std::shared_ptr<ConcurrentMap<T>> storage{entry.lock()};
+  if (not storage) {
+    storage = std::make_shared<ConcurrentMap<T>>();
+    entry = storage;
+  }
+  return storage;
+}
+
+ElementXsecCache::ElementXsecCache()
+  : the_cache_{std::make_shared<ConcurrentMap<std::shared_ptr<EnergyTable>>>()} {}
+
+ElementXsecCache::ElementXsecCache(std::shared_ptr<PrototypeModel> model)
+  : model_{model} {
+  try {
+    if (model_) shared_id_ = model_->GetXsecParameters();
+  } catch (const std::runtime_error&) {
+    // the model doesn't identify its cross sections, so we can't share them
+    shared_id_.clear();
+  }
+  the_cache_ = shared_id_.empty()
+      ? std::make_shared<ConcurrentMap<std::shared_ptr<EnergyTable>>>()
+      : sharedStorage<std::shared_ptr<EnergyTable>>(shared_id_);
+}
+
+void ElementXsecCache::interpolate(G4double min_energy, G4double max_energy,
+                                   double tolerance) {
+  if (min_energy <= 0. or max_energy <= min_energy) {
+    throw std::runtime_error("ElementXsecCache interpolation requires 0 < min_energy < max_energy.");
+  }
+  if (tolerance <= 0.) {
+    throw std::runtime_error("ElementXsecCache interpolation requires a positive tolerance.");
+  }
+  interpolate_ = true;
+  min_energy_ = min_energy;
+  max_energy_ = max_energy;
+  tolerance_ = tolerance;
+  if (shared_id_.empty()) {
+    the_grids_ = std::make_shared<ConcurrentMap<Grid>>();
+  } else {
+    std::ostringstream grid_id;
+    grid_id << std::setprecision(std::numeric_limits<double>::max_digits10)
+      << shared_id_ << ",grid=" << min_energy_ << "," << max_energy_ << "," << tolerance_;
+    the_grids_ = sharedStorage<Grid>(grid_id.str());
+  }
+}
+
+void ElementXsecCache::prepare(G4double A, G4double Z) {
+  if (interpolate_) grid(A, Z);
+}
+
 G4double ElementXsecCache::get(G4double energy, G4double A, G4double Z) {
-  key_t key = computeKey(energy, A, Z);
-  if (the_cache_.find(key) == the_cache_.end()) {
-    if (model_.get() == nullptr) {
-      throw std::runtime_error(
-                      "ElementXsecCache not given a model to calculate cross "
-                      "sections with.");
+  if (interpolate_ and energy >= min_energy_ and energy <= max_energy_) {
+    const Grid& g{grid(A, Z)};
+    hits_.add();
+    std::size_t i_high = std::upper_bound(g.energies.begin(), g.energies.end(), energy)
+                         - g.energies.begin();
+    if (i_high >= g.energies.size()) return g.xsecs.back();
+    std::size_t i_low = i_high - 1;
+    return g.xsecs[i_low] + (g.xsecs[i_high] - g.xsecs[i_low])
+           * (energy - g.energies[i_low]) / (g.energies[i_high] - g.energies[i_low]);
+  }
+
+  key_t energy_key = energy;
+  EnergyTable* t{nullptr};
+  if (energy_key < MAX_E) {
+    t = &table(A, Z);
+    const G4double* cached{t->find(energy_key)};
+    if (cached) {
+      hits_.add();
+      return *cached;
     }
-    the_cache_[key] = model_->ComputeCrossSectionPerAtom(energy, A, Z);
   }
-  return the_cache_.at(key);
+  if (model_.get() == nullptr) {
+    throw std::runtime_error(
+                    "ElementXsecCache not given a model to calculate cross "
+                    "sections with.");
+  }
+  // energies beyond the table are rare enough to not bother caching
+  if (not t) {
+    misses_.add();
+    return model_->ComputeCrossSectionPerAtom(energy, A, Z);
+  }
+  /*
+   * if other threads are missing the same entry, they wait for
+   * this calculation instead of repeating it
+   */
+  bool computed{false};
+  G4double xsec = t->at(energy_key).getOrCompute([&]() {
+    computed = true;
+    return model_->ComputeCrossSectionPerAtom(energy, A, Z);
+  });
+  if (computed) misses_.add();
+  else hits_.add();
+  return xsec;
+}
+
+ElementXsecCache::EnergyTable& ElementXsecCache::table(G4double A, G4double Z) {
+  key_t key = computeKey(0., A, Z);
+  const std::shared_ptr<EnergyTable>* cached{the_cache_->find(key)};
+  if (cached) return **cached;
+  return *the_cache_->getOrCompute(key, []() { return std::make_shared<EnergyTable>(); });
+}
+
+std::map<ElementXsecCache::key_t, G4double> ElementXsecCache::entries() const {
+  std::map<key_t, G4double> all;
+  the_cache_->forEach([&all](key_t element_key, const std::shared_ptr<EnergyTable>& t) {
+    t->forEach([&](key_t energy, G4double xsec) { all.emplace(element_key + energy, xsec); });
+  });
+  return all;
+}
+
+const ElementXsecCache::Grid& ElementXsecCache::grid(G4double A, G4double Z) {
+  key_t key = computeKey(0., A, Z);
+  const Grid* cached{the_grids_->find(key)};
+  if (cached) return *cached;
+  if (model_.get() == nullptr) {
+    throw std::runtime_error(
+                    "ElementXsecCache not given a model to calculate cross "
+                    "sections with.");
+  }
+  return the_grids_->getOrCompute(key, [&]() { return buildGrid(A, Z); });
+}
+
+ElementXsecCache::Grid ElementXsecCache::buildGrid(G4double A, G4double Z) const {
+
+  /*
+   * the initial log-spaced grid, the end points are always included
+   */
+  int n_points = std::max(2, int(std::ceil(std::log10(max_energy_/min_energy_)*POINTS_PER_DECADE))+1);
+  std::vector<G4double> energies, xsecs;
+  for (int i{0}; i < n_points; i++) {
+    G4double energy = (i+1 == n_points) ? max_energy_ :
+        min_energy_*std::pow(max_energy_/min_energy_, double(i)/(n_points-1));
+    energies.push_back(energy);
+    xsecs.push_back(model_->ComputeCrossSectionPerAtom(energy, A, Z));
+  }
+  G4double floor = 1e-3*(*std::max_element(xsecs.begin(), xsecs.end()));
+
+  /*
+   * refine each interval of the initial grid
+   */
+  Grid g;
+  for (int i{0}; i+1 < n_points; i++) {
+    g.energies.push_back(energies[i]);
+    g.xsecs.push_back(xsecs[i]);
+    refine(A, Z, energies[i], xsecs[i], energies[i+1], xsecs[i+1], floor, 0, g);
+  }
+  g.energies.push_back(energies.back());
+  g.xsecs.push_back(xsecs.back());
+  return g;
+}
+
+void ElementXsecCache::refine(G4double A, G4double Z, G4double e_low, G4double xsec_low,
+                              G4double e_high, G4double xsec_high, G4double floor,
+                              int depth, Grid& g) const {
+  G4double e_mid = std::sqrt(e_low*e_high);
+  G4double xsec_mid = model_->ComputeCrossSectionPerAtom(e_mid, A, Z);
+  G4double interpolated = xsec_low + (xsec_high - xsec_low)*(e_mid - e_low)/(e_high - e_low);
+  bool split = depth < MAX_DEPTH and
+      std::abs(interpolated - xsec_mid) > tolerance_*std::max(std::abs(xsec_mid), floor);
+  if (split) refine(A, Z, e_low, xsec_low, e_mid, xsec_mid, floor, depth+1, g);
+  // we already calculated the middle point, so we might as well keep it
+  g.energies.push_back(e_mid);
+  g.xsecs.push_back(xsec_mid);
+  if (split) refine(A, Z, e_mid, xsec_mid, e_high, xsec_high, floor, depth+1, g);
+}
+
+/**
+ * Copy the entries of a shared map into a sorted map
+ *
+ * @tparam T type of value
+ * @param[in] shared map to copy, may be nullptr
+ * @return sorted copy of the entries
+ */
+template <typename T>
+static std::map<typename ConcurrentMap<T>::key_t, T> sorted(
+    const std::shared_ptr<ConcurrentMap<T>>& shared) {
+  std::map<typename ConcurrentMap<T>::key_t, T> entries;
+  if (shared) {
+    shared->forEach([&entries](typename ConcurrentMap<T>::key_t key, const T& value) {
+      entries.emplace(key, value);
+    });
+  }
+  return entries;
 }
 
 void ElementXsecCache::stream(std::ostream& o) const {
   o << "A [au],Z [protons],Energy [MeV],Xsec [pb]\n"
     << std::setprecision(std::numeric_limits<double>::digits10 +
                          1);  // maximum precision
-  for (auto const& cache_entry : the_cache_) {
+  for (auto const& cache_entry : entries()) {
     const key_t& key = cache_entry.first;
     const double& xsec = cache_entry.second;
     key_t E = key % MAX_E;
@@ -27,9 +312,101 @@ void ElementXsecCache::stream(std::ostream& o) const {
     key_t Z = ((key - E) / MAX_E - A) / MAX_A;
     o << A << "," << Z << "," << E << "," << xsec / CLHEP::picobarn << "\n";
   }
+  for (auto const& grid_entry : sorted(the_grids_)) {
+    key_t A = (grid_entry.first / MAX_E) % MAX_A;
+    key_t Z = (grid_entry.first / MAX_E) / MAX_A;
+    const Grid& g{grid_entry.second};
+    for (std::size_t i{0}; i < g.energies.size(); i++) {
+      o << A << "," << Z << "," << g.energies[i] << "," << g.xsecs[i] / CLHEP::picobarn << "\n";
+    }
+  }
   o << std::endl;
 }
 
+const std::string ElementXsecCache::PARAMETERS_PREFIX{"# G4DarkBreM cross section cache: "};
+
+void ElementXsecCache::save(const std::string& path) const {
+  if (model_.get() == nullptr) {
+    throw std::runtime_error(
+                    "ElementXsecCache not given a model to identify the saved "
+                    "cross sections with.");
+  }
+  std::ofstream o{path};
+  if (not o.is_open()) {
+    throw std::runtime_error("Unable to open '"+path+"' to save cross section cache.");
+  }
+  o << PARAMETERS_PREFIX << model_->GetXsecParameters() << "\n"
+    << "A [au],Z [protons],Energy [MeV],Xsec [pb]\n"
+    << std::setprecision(std::numeric_limits<double>::max_digits10);
+  for (auto const& cache_entry : entries()) {
+    const key_t& key = cache_entry.first;
+    key_t E = key % MAX_E;
+    key_t A = (key / MAX_E) % MAX_A;
+    key_t Z = (key / MAX_E) / MAX_A;
+    o << A << "," << Z << "," << E << "," << cache_entry.second / CLHEP::picobarn << "\n";
+  }
+  o.close();
+  if (o.fail()) {
+    throw std::runtime_error("Unable to write cross section cache to '"+path+"'.");
+  }
+}
+
+void ElementXsecCache::load(const std::string& path) {
+  if (model_.get() == nullptr) {
+    throw std::runtime_error(
+                    "ElementXsecCache not given a model to check the loaded "
+                    "cross sections against.");
+  }
+  std::ifstream f{path};
+  if (not f.is_open()) {
+    throw std::runtime_error("Unable to open cross section cache '"+path+"'.");
+  }
+  std::string line;
+  std::getline(f, line);
+  if (line.compare(0, PARAMETERS_PREFIX.size(), PARAMETERS_PREFIX) != 0) {
+    throw std::runtime_error("'"+path+"' is not a cross section cache written by G4DarkBreM.");
+  }
+  std::string parameters{line.substr(PARAMETERS_PREFIX.size())};
+  if (parameters != model_->GetXsecParameters()) {
+    throw std::runtime_error("Cross section cache '"+path+"' was calculated with different parameters.\n"
+        "  Cache: "+parameters+"\n"
+        "  Model: "+model_->GetXsecParameters());
+  }
+  std::getline(f, line);  // skip header
+  std::map<std::pair<key_t, key_t>, G4double> loaded;
+  int line_number{2};
+  while (std::getline(f, line)) {
+    line_number++;
+    if (line.empty()) continue;
+    double values[4];
+    std::size_t start{0};
+    for (int i{0}; i < 4; i++) {
+      std::size_t end = (i < 3) ? line.find(',', start) : line.size();
+      if (end == std::string::npos) {
+        throw std::runtime_error("Malformed row in cross section cache '"+path+"' (line "
+            +std::to_string(line_number)+").");
+      }
+      values[i] = std::stod(line.substr(start, end-start));
+      start = end+1;
+    }
+    key_t energy_key = values[2];
+    if (energy_key >= MAX_E) {
+      throw std::runtime_error("Energy beyond the cache in cross section cache '"+path+"' (line "
+          +std::to_string(line_number)+").");
+    }
+    loaded[std::make_pair(computeKey(0., values[0], values[1]), energy_key)] = values[3]*CLHEP::picobarn;
+  }
+  /*
+   * only insert into the cache once the whole file is read,
+   * entries already in the cache are kept
+   */
+  for (auto const& loaded_entry : loaded) {
+    key_t A = (loaded_entry.first.first / MAX_E) % MAX_A;
+    key_t Z = (loaded_entry.first.first / MAX_E) / MAX_A;
+    table(A, Z).at(loaded_entry.first.second).set(loaded_entry.second);
+  }
+}
+
 ElementXsecCache::key_t ElementXsecCache::computeKey(G4double energy,
                                                      G4double A,
                                                      G4double Z) const {
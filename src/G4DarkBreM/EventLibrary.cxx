@@ -0,0 +1,91 @@
+#include "G4DarkBreM/EventLibrary.h"
+#include "G4DarkBreM/BinaryLibrary.h"
+
+namespace g4db {
+
+/**
+ * Get the value of a column from a parsed event
+ *
+ * @param[in] ok parsed event
+ * @param[in] c column to get
+ * @return value of that column
+ */
+static double columnValue(const OutgoingKinematics& ok, EventLibrary::Column c) {
+  switch (c) {
+    case EventLibrary::RecoilE : return ok.lepton.e();
+    case EventLibrary::RecoilPx: return ok.lepton.px();
+    case EventLibrary::RecoilPy: return ok.lepton.py();
+    case EventLibrary::RecoilPz: return ok.lepton.pz();
+    case EventLibrary::CenterE : return ok.centerMomentum.e();
+    case EventLibrary::CenterPx: return ok.centerMomentum.px();
+    case EventLibrary::CenterPy: return ok.centerMomentum.py();
+    case EventLibrary::CenterPz: return ok.centerMomentum.pz();
+    default: return 0.;
+  }
+}
+
+EventLibrary::EventLibrary(const std::map<double, std::vector<OutgoingKinematics>>& lib,
+                           unsigned int column_mask) {
+  offsets_storage_.reserve(lib.size()+1);
+  offsets_storage_.push_back(0);
+  energies_storage_.reserve(lib.size());
+  for (const auto& lib_entry : lib) {
+    energies_storage_.push_back(lib_entry.first);
+    offsets_storage_.push_back(offsets_storage_.back() + lib_entry.second.size());
+  }
+  std::size_t n_events = offsets_storage_.back();
+
+  int n_kept{0};
+  for (int c{0}; c < NColumns; c++) {
+    if (column_mask & (1u << c)) n_kept++;
+  }
+  columns_storage_.resize(n_kept*n_events);
+
+  /*
+   * Fill the kept columns one after the other into the single
+   * storage vector, leaving the columns we don't keep as nullptr
+   */
+  int i_kept{0};
+  for (int c{0}; c < NColumns; c++) {
+    if (not (column_mask & (1u << c))) {
+      columns_[c] = nullptr;
+      continue;
+    }
+    double* column = columns_storage_.data() + i_kept*n_events;
+    for (const auto& lib_entry : lib) {
+      for (const auto& ok : lib_entry.second) {
+        *column++ = columnValue(ok, Column(c));
+      }
+    }
+    columns_[c] = columns_storage_.data() + i_kept*n_events;
+    i_kept++;
+  }
+
+  n_energies_ = energies_storage_.size();
+  energies_ = energies_storage_.data();
+  offsets_ = offsets_storage_.data();
+}
+
+EventLibrary::EventLibrary(const std::string& binary_path)
+  : mapped_{new binary::MappedLibrary(binary_path)} {
+  n_energies_ = mapped_->numEnergies();
+  energies_ = mapped_->energies();
+  offsets_ = mapped_->offsets();
+  for (int c{0}; c < NColumns; c++) {
+    columns_[c] = mapped_->column(Column(c));
+  }
+}
+
+/*
+ * defined here so that the MappedLibrary is a complete type
+ * when the std::unique_ptr is destructed
+ */
+EventLibrary::~EventLibrary() = default;
+
+std::size_t EventLibrary::size() const {
+  if (mapped_) return mapped_->size();
+  return sizeof(double)*(energies_storage_.size() + columns_storage_.size())
+         + sizeof(std::uint64_t)*offsets_storage_.size();
+}
+
+}  // namespace g4db
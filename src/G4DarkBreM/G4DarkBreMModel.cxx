@@ -1,11 +1,14 @@
 
 #include "G4DarkBreM/G4DarkBreMModel.h"
 #include "G4DarkBreM/G4APrime.h"
+#include "G4DarkBreM/BinaryLibrary.h"
+#include "G4DarkBreM/CMScaling.h"
 #include "G4DarkBreM/ParseLibrary.h"
 
 // Geant4
 #include "Randomize.hh"
 #include "G4Electron.hh"
+#include "G4Element.hh"
 #include "G4MuonMinus.hh"
 #include "G4EventManager.hh"  //for EventID number
 #include "G4PhysicalConstants.hh"
@@ -13,12 +16,19 @@
 #include "G4SystemOfUnits.hh"
 
 // Boost
+#include <boost/math/quadrature/gauss.hpp>
 #include <boost/math/quadrature/gauss_kronrod.hpp>
 
 // STL
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 namespace g4db {
 
@@ -101,25 +111,60 @@ static double flux_factor_chi_numerical(G4double A, G4double Z, double tmin, dou
  * analytic flux factor chi integrated and simplified by DMG4 authors
  *
  * This only includes the elastic form factor term
+ *
+ * The terms that only depend on the element are calculated once on
+ * construction so that they are not recalculated for each of the many
+ * t ranges that a muon cross section needs.
  */
-static double flux_factor_chi_analytic(G4double A, G4double Z, double tmin, double tmax) {
-  static const double mel = 0.000511;
-  const double a_el = 111.*pow(Z,-1./3)/mel,
-               d_el = 0.164*pow(A,-2./3);
-  double ta = 1.0/(a_el*a_el);
-  double td = d_el;
-  return -Z*Z*((td*td*(
-              ((ta - td)*(ta + td + 2.0*tmax)*(tmax - tmin))/((ta + tmax)*(td + tmax)) 
-              + (ta + td + 2.0*tmin)*(log(ta + tmax) - log(td + tmax) - log(ta + tmin) + log(td + tmin))
-             ))/((ta-td)*(ta-td)*(ta-td)));
-}
+class FluxFactorChiAnalytic {
+ public:
+  /**
+   * Calculate the element-dependent terms
+   *
+   * @param[in] A atomic mass [amu]
+   * @param[in] Z atomic number
+   */
+  FluxFactorChiAnalytic(G4double A, G4double Z) {
+    static const double mel = 0.000511;
+    const double a_el = 111.*pow(Z,-1./3)/mel,
+                 d_el = 0.164*pow(A,-2./3);
+    ta_ = 1.0/(a_el*a_el);
+    td_ = d_el;
+    norm_ = -Z*Z*td_*td_/((ta_-td_)*(ta_-td_)*(ta_-td_));
+  }
+
+  /**
+   * Calculate chi for the input t range
+   *
+   * @param[in] tmin lower limit on t
+   * @param[in] tmax upper limit on t
+   * @return chi
+   */
+  double operator()(double tmin, double tmax) const {
+    return norm_*(
+              ((ta_ - td_)*(ta_ + td_ + 2.0*tmax)*(tmax - tmin))/((ta_ + tmax)*(td_ + tmax))
+              + (ta_ + td_ + 2.0*tmin)*(log(ta_ + tmax) - log(td_ + tmax) - log(ta_ + tmin) + log(td_ + tmin))
+             );
+  }
+
+ private:
+  /// inverse square of the atomic screening radius
+  double ta_;
+  /// nuclear size parameter
+  double td_;
+  /// overall normalization
+  double norm_;
+};
 
 G4DarkBreMModel::G4DarkBreMModel(const std::string& method_name, double threshold,
     double epsilon, const std::string& library_path, bool muons, int aprime_lhe_id, 
     bool load_library)
     : PrototypeModel(muons), maxIterations_{10000}, 
       threshold_{std::max(threshold, 2.*G4APrime::APrime()->GetPDGMass()/CLHEP::GeV)},
-      epsilon_{epsilon}, aprime_lhe_id_{aprime_lhe_id}, 
+      epsilon_{epsilon},
+      lepton_mass_{(muons ? G4MuonMinus::MuonMinus()->GetPDGMass()
+                          : G4Electron::Electron()->GetPDGMass()) / CLHEP::GeV},
+      aprime_lhe_id_{aprime_lhe_id}, 
       method_(DarkBremMethod::Undefined), method_name_{method_name}, 
       library_path_{library_path} {
   if (method_name_ == "forward_only") {
@@ -133,6 +178,16 @@ G4DarkBreMModel::G4DarkBreMModel(const std::string& method_name, double threshol
   }
 
   if (load_library) SetMadGraphDataLibrary(library_path_);
+
+  /*
+   * electrons use the tabulated chi, so we build the tables for the
+   * elements that have been defined so far while we are setting up
+   */
+  if (not muons_) {
+    for (const G4Element* element : *G4Element::GetElementTable()) {
+      GetChiTable(element->GetA() / (g / mole), element->GetZ());
+    }
+  }
 }
 
 void G4DarkBreMModel::PrintInfo() const {
@@ -141,6 +196,35 @@ void G4DarkBreMModel::PrintInfo() const {
   G4cout << "   Epsilon:         " << epsilon_ << G4endl;
   G4cout << "   Scaling Method:  " << method_name_ << G4endl;
   G4cout << "   Vertex Library:  " << library_path_ << G4endl;
+  if (instrumentation::ENABLED) PrintCounters();
+}
+
+void G4DarkBreMModel::PrintCounters() const {
+  G4cout << " Dark Brem Vertex Library Model Counters" << G4endl;
+  G4cout << "   Cross Sections:  " << xsec_timer_.calls()
+    << " in " << xsec_timer_.seconds() << " s" << G4endl;
+  if (method_ == DarkBremMethod::ForwardOnly) {
+    G4cout << "   ForwardOnly Unphysical Vertices: " << forward_only_fallbacks_.get() << G4endl;
+    G4cout << "   ForwardOnly Events Skipped per Vertex (without index):" << G4endl;
+    forward_only_rejections_.print(G4cout, "     ");
+    G4cout << std::flush;
+  }
+}
+
+std::string G4DarkBreMModel::GetXsecParameters() const {
+  std::ostringstream parameters;
+  parameters << std::setprecision(std::numeric_limits<double>::max_digits10)
+    << "lepton=" << (muons_ ? "muon" : "electron")
+    << ",mA=" << G4APrime::APrime()->GetPDGMass()/CLHEP::GeV
+    << ",method=" << method_name_
+    << ",threshold=" << threshold_
+    << ",epsilon=" << epsilon_;
+  if (muons_ and adaptive_muon_integration_) parameters << ",integration=adaptive";
+  return parameters.str();
+}
+
+G4double G4DarkBreMModel::GetMinimumKineticEnergy() const {
+  return std::max(keV, threshold_*GeV);
 }
 
 G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
@@ -149,8 +233,7 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
   static const double MA2 = MA*MA;
   static const double alphaEW = 1.0 / 137.0;
 
-  const double lepton_mass{
-    (muons_ ? G4MuonMinus::MuonMinus()->GetPDGMass() : G4Electron::Electron()->GetPDGMass()) / GeV};
+  const double lepton_mass{lepton_mass_};
   const double lepton_mass_sq{lepton_mass*lepton_mass};
 
   // the cross section is zero if the lepton does not have enough
@@ -160,6 +243,8 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
   // space
   if (lepton_ke < keV or lepton_ke < threshold_*GeV) return 0.;
 
+  instrumentation::Timer::Scope timing(xsec_timer_);
+
   // Change energy to GeV.
   double lepton_e = lepton_ke/GeV + lepton_mass;
   double lepton_e_sq = lepton_e*lepton_e;
@@ -169,8 +254,10 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
    *
    * assume theta = 0, and x = 1 for form factor integration
    * i.e. now chi is a constant pulled out of the integration
+   *
+   * only electrons use this chi
    */
-  double chi_hiww = flux_factor_chi_numerical(A,Z,MA2*MA2/(4*lepton_e_sq),MA2+lepton_mass_sq);
+  double chi_hiww = muons_ ? 0. : FluxFactorChiHIWW(A, Z, lepton_e);
 
   /*
    * Differential cross section with respect to x and theta
@@ -183,6 +270,10 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
    * of this function is a double since it is calculated by arithmetic
    * operations on doubles.
    */
+  // element-dependent terms of chi and the couplings are the same for the whole integral
+  const FluxFactorChiAnalytic flux_factor_chi_analytic(A, Z);
+  const double couplings = pow(epsilon_,2.)*pow(alphaEW,3.);
+
   auto diff_cross = [&](double x, double theta) {
     if (x*lepton_e < threshold_) return 0.;
 
@@ -253,7 +344,7 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
      * according to Mathematica so it is expensive to
      * compute and only an O(few) percent change.
      */
-    double chi_analytic_elastic_only = flux_factor_chi_analytic(A,Z,tmin,tmax);
+    double chi_analytic_elastic_only = flux_factor_chi_analytic(tmin,tmax);
     
     /*
      * Amplitude squared is taken from 
@@ -265,7 +356,7 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
     double factor3 = utilde*x + MA2*(1. - x) + lepton_mass_sq*x_sq;
     double amplitude_sq = factor1 + factor2*factor3;
 
-    return 2.*pow(epsilon_,2.)*pow(alphaEW,3.)
+    return 2.*couplings
              *sqrt(x_sq*lepton_e_sq - MA2)*lepton_e*(1.-x)
              *(chi_analytic_elastic_only/utilde_sq)*amplitude_sq*sin(theta);
   };
@@ -316,12 +407,54 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
       double beta = sqrt(1 - MA2/lepton_e_sq),
              nume = 1. - x + x*x/3.,
              deno = MA2*(1-x)/x + lepton_mass_sq;
-      return 4*pow(epsilon_,2)*pow(alphaEW,3)*chi_hiww*beta*nume/deno;
+      return 4*couplings*chi_hiww*beta*nume/deno;
     }
   };
 
-  double error;
-  double integrated_xsec = int_method::integrate(theta_integral, xmin, xmax, 5, 1e-9, &error);
+  double integrated_xsec{0.};
+  if (muons_ and not adaptive_muon_integration_) {
+    /*
+     * Fixed tensor-product Gauss-Legendre rule for muons
+     *
+     * The nested adaptive integrals need tens to hundreds of thousands
+     * of evaluations of diff_cross since the integrand is sharply peaked
+     * in both x and theta at high energies. We instead change variables
+     * so that the integrand is smooth and use a fixed number of nodes
+     * whose positions and weights are tabulated by boost.
+     *
+     * - x is mapped to z = log(x/(1-x)) over the range where the cross
+     *   section is non-zero, spreading out the regions near 0 and 1.
+     * - utilde is -x E^2 (theta^2 + theta_c^2), so theta is mapped to
+     *   s = log(theta^2 + theta_c^2) which turns the 1/utilde^2 peak
+     *   below theta_c into a smooth fall-off. Above the angle where tmin
+     *   reaches tmax, diff_cross is zero so the s range stops there.
+     */
+    using x_rule = boost::math::quadrature::gauss<double, MUON_X_NODES>;
+    using s_rule = boost::math::quadrature::gauss<double, MUON_THETA_NODES>;
+    double x_lo = threshold_/lepton_e;
+    if (x_lo < xmax) {
+      auto z_integrand = [&](double z) {
+        double x = 1./(1. + std::exp(-z));
+        double theta_c_sq = (MA2*(1.-x)/x + lepton_mass_sq*x)/(x*lepton_e_sq);
+        double theta_sq_max = std::min(theta_max*theta_max, 2.*(1.-x)/x - theta_c_sq);
+        if (theta_sq_max <= 0.) return 0.;
+        auto s_integrand = [&](double s) {
+          double theta_sq_plus_c_sq = std::exp(s);
+          double theta_sq = theta_sq_plus_c_sq - theta_c_sq;
+          if (theta_sq <= 0.) return 0.;
+          double theta = std::sqrt(theta_sq);
+          return diff_cross(x, theta)*theta_sq_plus_c_sq/(2.*theta);
+        };
+        return s_rule::integrate(s_integrand, std::log(theta_c_sq),
+                                 std::log(theta_sq_max + theta_c_sq))*x*(1.-x);
+      };
+      integrated_xsec = x_rule::integrate(z_integrand,
+          std::log(x_lo/(1.-x_lo)), std::log(xmax/(1.-xmax)));
+    }
+  } else {
+    double error;
+    integrated_xsec = int_method::integrate(theta_integral, xmin, xmax, 5, 1e-9, &error);
+  }
 
   G4double GeVtoPb = 3.894E08;
 
@@ -336,70 +469,213 @@ G4double G4DarkBreMModel::ComputeCrossSectionPerAtom(
   return cross;
 }
 
+double G4DarkBreMModel::FluxFactorChiHIWW(double A, double Z, double lepton_e, bool tabulated) {
+  static const double MA = G4APrime::APrime()->GetPDGMass() / GeV;
+  static const double MA2 = MA*MA;
+  const double lepton_mass{lepton_mass_};
+
+  if (tabulated) {
+    const ChiTable& table{GetChiTable(A, Z)};
+    double u = (std::log(lepton_e) - table.log_e_min) / table.log_e_step;
+    if (u >= 0. and u <= table.log_chi.size() - 1) {
+      std::size_t i = std::min<std::size_t>(u, table.log_chi.size() - 2);
+      double f = u - i;
+      return std::exp(table.log_chi[i]*(1.-f) + table.log_chi[i+1]*f);
+    }
+  }
+
+  return flux_factor_chi_numerical(A, Z, MA2*MA2/(4*lepton_e*lepton_e), MA2 + lepton_mass*lepton_mass);
+}
+
+const G4DarkBreMModel::ChiTable& G4DarkBreMModel::GetChiTable(double A, double Z) {
+  // hold the lock while building so that each table is only built once
+  std::lock_guard<std::mutex> lock(chi_tables_mutex_);
+  auto table_it = chi_tables_.find(std::make_pair(A, Z));
+  if (table_it != chi_tables_.end()) return table_it->second;
+
+  const double lepton_mass{lepton_mass_};
+
+  // the lowest energy with a non-zero cross section (see ComputeCrossSectionPerAtom)
+  ChiTable table;
+  table.log_e_min = std::log(std::max(threshold_, keV/GeV) + lepton_mass);
+  table.log_e_step = std::log(10.) / CHI_POINTS_PER_DECADE;
+  table.log_chi.resize(CHI_POINTS_PER_DECADE*CHI_DECADES + 1);
+  for (std::size_t i{0}; i < table.log_chi.size(); i++) {
+    table.log_chi[i] = std::log(FluxFactorChiHIWW(A, Z,
+          std::exp(table.log_e_min + i*table.log_e_step), false));
+  }
+  return chi_tables_.emplace(std::make_pair(A, Z), std::move(table)).first->second;
+}
+
 G4ThreeVector G4DarkBreMModel::scale(double incident_energy, double lepton_mass) {
+  double px, py, pz;
+  scale(incident_energy, lepton_mass, 1, &px, &py, &pz);
+  return G4ThreeVector(px, py, pz);
+}
+
+void G4DarkBreMModel::scale(double incident_energy, double lepton_mass, std::size_t n,
+                            double* px, double* py, double* pz, double* energy) {
   // mass A' in GeV
   static const double MA = G4APrime::APrime()->GetPDGMass() / CLHEP::GeV;
-  OutgoingKinematics data = sample(incident_energy);
-  double EAcc = (data.lepton.e() - lepton_mass) *
-                    ((incident_energy - lepton_mass - MA) / (data.E - lepton_mass - MA))
-                + lepton_mass;
-  double Pt = data.lepton.perp();
-  double P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
-  if (method_ == DarkBremMethod::ForwardOnly) {
-    unsigned int i = 0;
-    while (Pt * Pt + lepton_mass * lepton_mass > EAcc * EAcc) {
-      // Skip events until the transverse energy is less than the total energy.
-      i++;
-      data = sample(incident_energy);
-      EAcc = (data.lepton.e() - lepton_mass) *
-                 ((incident_energy - lepton_mass - MA) / (data.E - lepton_mass - MA))
-             + lepton_mass;
-      Pt = data.lepton.perp();
-      P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
 
-      if (i > maxIterations_) {
-        std::cerr
-            << "Could not produce a realistic vertex with library energy "
-            << data.lepton.e() << " GeV.\n"
-            << "Consider expanding your libary of A' vertices to include a "
-               "beam energy closer to "
-            << incident_energy << " GeV."
-            << std::endl;
-        break;
+  // the access points are per thread, so the first
+  // call on each thread needs to set them up
+  std::vector<unsigned int>& current_data_points{currentDataPoints_.Get()};
+  if (current_data_points.empty()) MakePlaceholders();
+
+  /*
+   * All of the events in the batch are sampled from the same imported
+   * beam energy: the closest one above the incident energy or the max
+   * if the incident energy is above all of them.
+   */
+  const std::size_t i_energy = library_->findEnergy(incident_energy);
+  const double sample_energy = library_->energies()[i_energy];
+  const std::size_t n_events = library_->numEvents(i_energy);
+  unsigned int& current_data_point{current_data_points[i_energy]};
+  const double* recoil_e = library_->column(EventLibrary::RecoilE, i_energy);
+  const double* recoil_px = library_->column(EventLibrary::RecoilPx, i_energy);
+  const double* recoil_py = library_->column(EventLibrary::RecoilPy, i_energy);
+
+  // fraction of the kinetic energy available to the recoil and A'
+  // in the actual interaction relative to the sampled interaction
+  const double ke_ratio = (incident_energy - lepton_mass - MA) / (sample_energy - lepton_mass - MA);
+
+  /**
+   * Get the index of the next event to use from the library
+   *
+   * Need to loop around if we hit the end, in case our random
+   * starting position happens to be late enough in the file.
+   * The current index is incremented _after_ getting its entry.
+   */
+  auto next_event = [&]() -> std::size_t {
+    if (current_data_point >= n_events) current_data_point = 0;
+    return current_data_point++;
+  };
+
+  /*
+   * The ForwardOnly index can be used if it was built for this lepton,
+   * in which case the events that stay physical are the leading
+   * n_valid entries of the index for this energy and we choose
+   * one of them with a second random number for each vertex.
+   */
+  const bool use_index = method_ == DarkBremMethod::ForwardOnly
+                         and forward_index_ and forward_index_->lepton_mass == lepton_mass;
+  std::size_t n_valid{0};
+  const std::uint32_t* index_event{nullptr};
+  if (use_index) {
+    const ForwardBin& bin{GetForwardBin(i_energy)};
+    const double* min_ke_ratio = bin.min_ke_ratio.data();
+    n_valid = std::upper_bound(min_ke_ratio, min_ke_ratio + n_events, ke_ratio) - min_ke_ratio;
+    index_event = bin.event.data();
+    if (n_valid == 0) {
+      forward_only_fallbacks_.add(n);
+      std::cerr
+          << "Could not produce a realistic vertex with library energy "
+          << sample_energy << " GeV.\n"
+          << "Consider expanding your libary of A' vertices to include a "
+             "beam energy closer to "
+          << incident_energy << " GeV."
+          << std::endl;
+    }
+  }
+
+  /*
+   * The CMScaling boosts are done for the whole batch at once by
+   * running the kernel over the stretches of consecutive events
+   * in the library that the batch goes through.
+   */
+  ScaleScratch& scratch{scaleScratch_.Get()};
+  std::vector<double>& cm_e_acc{scratch.cm_e_acc};
+  std::vector<double>& cm_pt{scratch.cm_pt};
+  std::vector<double>& cm_p{scratch.cm_p};
+  if (method_ == DarkBremMethod::CMScaling) {
+    cm_e_acc.resize(n);
+    cm_pt.resize(n);
+    cm_p.resize(n);
+    std::size_t n_done{0};
+    while (n_done < n) {
+      if (current_data_point >= n_events) current_data_point = 0;
+      std::size_t n_stretch = std::min<std::size_t>(n - n_done, n_events - current_data_point);
+      const double* columns[EventLibrary::NColumns];
+      for (int c{0}; c < EventLibrary::NColumns; c++) {
+        columns[c] = library_->column(EventLibrary::Column(c), i_energy) + current_data_point;
       }
+      cmScaling(n_stretch, columns, sample_energy, incident_energy, lepton_mass, ke_ratio,
+                cm_e_acc.data() + n_done, cm_pt.data() + n_done, cm_p.data() + n_done);
+      current_data_point += n_stretch;
+      n_done += n_stretch;
     }
-  } else if (method_ == DarkBremMethod::CMScaling) {
-    CLHEP::HepLorentzVector el(data.lepton.px(), data.lepton.py(), data.lepton.pz(),
-                               data.lepton.e());
-    double ediff = data.E - incident_energy;
-    CLHEP::HepLorentzVector newcm(data.centerMomentum.px(), data.centerMomentum.py(),
-                                  data.centerMomentum.pz() - ediff,
-                                  data.centerMomentum.e() - ediff);
-    el.boost(-1. * data.centerMomentum.boostVector());
-    el.boost(newcm.boostVector());
-    double newE = (data.lepton.e() - lepton_mass) *
-                      ((incident_energy - lepton_mass - MA) / (data.E - lepton_mass - MA)) +
-                  lepton_mass;
-    el.setE(newE);
-    EAcc = el.e();
-    Pt = el.perp();
-    P = el.vect().mag();
-  } else if (method_ == DarkBremMethod::Undefined) {
-    EAcc = data.lepton.e();
-    P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
-    Pt = data.lepton.perp();
   }
 
-  // outgoing lepton momentum
-  G4double PhiAcc = G4UniformRand()*2*pi;
-  G4double recoilMag = sqrt(EAcc * EAcc - lepton_mass*lepton_mass)*GeV;
-  G4ThreeVector recoil;
-  double ThetaAcc = std::asin(Pt / P);
-  recoil.set(std::sin(ThetaAcc) * std::cos(PhiAcc),
-                             std::sin(ThetaAcc) * std::sin(PhiAcc),
-                             std::cos(ThetaAcc));
-  recoil.setMag(recoilMag);
-  return recoil;
+  // draw all of the random numbers at once, interleaved per vertex
+  // so that a batch draws the same numbers as single vertices
+  const std::size_t n_rand_per = use_index ? 2 : 1;
+  std::vector<double>& rand{scratch.rand};
+  rand.resize(n_rand_per*n);
+  G4Random::getTheEngine()->flatArray(int(rand.size()), rand.data());
+
+  for (std::size_t i_batch{0}; i_batch < n; i_batch++) {
+    double EAcc, Pt, P;
+    if (use_index) {
+      // fall back to the event closest to being physical if none are
+      std::size_t i_valid = std::min<std::size_t>(
+          rand[n_rand_per*i_batch+1]*n_valid, n_valid > 0 ? n_valid-1 : 0);
+      std::size_t i_event = index_event[i_valid];
+      EAcc = (recoil_e[i_event] - lepton_mass) * ke_ratio + lepton_mass;
+      Pt = std::sqrt(recoil_px[i_event]*recoil_px[i_event] + recoil_py[i_event]*recoil_py[i_event]);
+      P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
+    } else if (method_ == DarkBremMethod::ForwardOnly) {
+      std::size_t i_event = next_event();
+      EAcc = (recoil_e[i_event] - lepton_mass) * ke_ratio + lepton_mass;
+      Pt = std::sqrt(recoil_px[i_event]*recoil_px[i_event] + recoil_py[i_event]*recoil_py[i_event]);
+      unsigned int i = 0;
+      while (Pt * Pt + lepton_mass * lepton_mass > EAcc * EAcc) {
+        // Skip events until the transverse energy is less than the total energy.
+        i++;
+        i_event = next_event();
+        EAcc = (recoil_e[i_event] - lepton_mass) * ke_ratio + lepton_mass;
+        Pt = std::sqrt(recoil_px[i_event]*recoil_px[i_event] + recoil_py[i_event]*recoil_py[i_event]);
+
+        if (i > maxIterations_) {
+          forward_only_fallbacks_.add();
+          std::cerr
+              << "Could not produce a realistic vertex with library energy "
+              << recoil_e[i_event] << " GeV.\n"
+              << "Consider expanding your libary of A' vertices to include a "
+                 "beam energy closer to "
+              << incident_energy << " GeV."
+              << std::endl;
+          break;
+        }
+      }
+      forward_only_rejections_.fill(i);
+      P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
+    } else if (method_ == DarkBremMethod::CMScaling) {
+      EAcc = cm_e_acc[i_batch];
+      Pt = cm_pt[i_batch];
+      P = cm_p[i_batch];
+    } else {
+      // DarkBremMethod::Undefined
+      std::size_t i_event = next_event();
+      EAcc = recoil_e[i_event];
+      P = sqrt(EAcc * EAcc - lepton_mass * lepton_mass);
+      Pt = std::sqrt(recoil_px[i_event]*recoil_px[i_event] + recoil_py[i_event]*recoil_py[i_event]);
+    }
+
+    // outgoing lepton momentum
+    G4double PhiAcc = rand[n_rand_per*i_batch]*2*pi;
+    G4double recoilMag = sqrt(EAcc * EAcc - lepton_mass*lepton_mass)*GeV;
+    G4ThreeVector recoil;
+    double ThetaAcc = std::asin(Pt / P);
+    recoil.set(std::sin(ThetaAcc) * std::cos(PhiAcc),
+                               std::sin(ThetaAcc) * std::sin(PhiAcc),
+                               std::cos(ThetaAcc));
+    recoil.setMag(recoilMag);
+    px[i_batch] = recoil.x();
+    py[i_batch] = recoil.y();
+    pz[i_batch] = recoil.z();
+    if (energy) energy[i_batch] = EAcc*GeV;
+  }
 }
 
 void G4DarkBreMModel::GenerateChange(
@@ -451,23 +727,88 @@ void G4DarkBreMModel::GenerateChange(
   }
 }
 
+/**
+ * Load a library or get the already loaded copy of it
+ *
+ * Geant4 constructs the physics (and therefore a model) once for each thread
+ * in multi-threaded running. The loaded libraries are kept in a registry so
+ * that a library is only loaded once and is shared read-only between all of
+ * the models using it. The registry only holds weak references, so the library
+ * is released once the last model using it is destroyed.
+ *
+ * @param[in] path path to library
+ * @param[in] aprime_lhe_id PDG ID of A' in LHE files
+ * @param[in] column_mask columns of the library to keep
+ * @return shared library
+ */
+static std::shared_ptr<const EventLibrary> loadLibrary(const std::string& path,
+    int aprime_lhe_id, unsigned int column_mask) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::weak_ptr<const EventLibrary>> registry;
+  const std::string key{path+":"+std::to_string(aprime_lhe_id)+":"+std::to_string(column_mask)};
+  /*
+   * we hold the lock while loading so that other threads
+   * wait for the library instead of loading it again
+   */
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::shared_ptr<const EventLibrary> lib = registry[key].lock();
+  if (lib) return lib;
+  if (binary::isBinaryLibrary(path)) {
+    lib = std::make_shared<const EventLibrary>(path);
+  } else {
+    // the parsed library is released once it is copied, but both are held until then
+    std::map<double, std::vector<OutgoingKinematics>> parsed;
+    parseLibrary(path, aprime_lhe_id, parsed, std::thread::hardware_concurrency());
+    lib = std::make_shared<const EventLibrary>(parsed, column_mask);
+  }
+  registry[key] = lib;
+  return lib;
+}
+
 void G4DarkBreMModel::SetMadGraphDataLibrary(const std::string& path) {
   /*
    * print status to user so they know what's happening
    */
   if (GetVerboseLevel() > 0) G4cout << "[ G4DarkBreMModel ] : loading event librariy..." << G4endl;
 
-  parseLibrary(path, aprime_lhe_id_, madGraphData_);
+  /*
+   * only the recoil energy and transverse momentum are used
+   * unless we are scaling in the center-of-momentum frame,
+   * so we can drop the other columns when copying the library
+   * into compact storage
+   */
+  unsigned int column_mask = EventLibrary::ALL_COLUMNS;
+  if (method_ != DarkBremMethod::CMScaling) {
+    column_mask = (1u << EventLibrary::RecoilE)
+                | (1u << EventLibrary::RecoilPx)
+                | (1u << EventLibrary::RecoilPy);
+  }
+  library_ = loadLibrary(path, aprime_lhe_id_, column_mask);
 
-  if (madGraphData_.size() == 0) {
+  if (library_->numEvents() == 0) {
     throw std::runtime_error("BadConf : Unable to find any library entries at '"+path+"'\n"
-        "  The library is either a single CSV file or a directory of LHE files.\n"
-        "  Any individual file can be compressed with `gzip`.\n"
-        "  This means the valid extensions are '.lhe', '.lhe.gz', '.csv', and '.csv.gz'");
+        "  The library is either a single CSV file, a binary library, or a directory of LHE files.\n"
+        "  Any individual text file can be compressed with `gzip`.\n"
+        "  This means the valid extensions are '.lhe', '.lhe.gz', '.csv', '.csv.gz', and '"
+        +binary::EXTENSION+"'");
+  }
+
+  /*
+   * update maxIterations_ so that it is equal to the smallest
+   * entry in the library (with a maximum of 10k)
+   */
+  maxIterations_ = 10000;
+  for (std::size_t i{0}; i < library_->numEnergies(); i++) {
+    if (library_->numEvents(i) < maxIterations_)
+      maxIterations_ = library_->numEvents(i);
   }
 
   MakePlaceholders();  // Setup the placeholder offsets for getting data.
 
+  if (method_ == DarkBremMethod::ForwardOnly) {
+    MakeForwardIndex(lepton_mass_);
+  }
+
   if (GetVerboseLevel() > 0) G4cout << "[ G4DarkBreMModel ] : done" << G4endl;
 
   /*
@@ -475,51 +816,63 @@ void G4DarkBreMModel::SetMadGraphDataLibrary(const std::string& path) {
    */
   if (GetVerboseLevel() > 1) {
     G4cout << "MadGraph Library of Dark Brem Events:\n";
-    for (const auto &kV : madGraphData_) {
-      G4cout << "\t" << kV.first << " GeV Beam -> "
-                << kV.second.size() << " Events\n";
+    for (std::size_t i{0}; i < library_->numEnergies(); i++) {
+      G4cout << "\t" << library_->energies()[i] << " GeV Beam -> "
+                << library_->numEvents(i) << " Events\n";
     }
-    G4cout << G4endl;
+    G4cout << "\t" << library_->size()/1024./1024. << " MB in total" << G4endl;
   }
 
   return;
 }
 
 void G4DarkBreMModel::MakePlaceholders() {
-  currentDataPoints_.clear();
-  maxIterations_ = 10000;
-  for (const auto &iter : madGraphData_) {
-    currentDataPoints_[iter.first] = int(G4UniformRand() * iter.second.size());
-    if (iter.second.size() < maxIterations_)
-      maxIterations_ = iter.second.size();
+  std::vector<unsigned int>& current_data_points{currentDataPoints_.Get()};
+  current_data_points.clear();
+  for (std::size_t i{0}; i < library_->numEnergies(); i++) {
+    current_data_points.push_back(int(G4UniformRand() * library_->numEvents(i)));
   }
 }
 
-OutgoingKinematics
-G4DarkBreMModel::sample(double incident_energy) {
-  // Cycle through imported beam energies until the closest one above is found,
-  // or the max is reached.
-  double samplingE = 0.;
-  for (const auto &keyVal : currentDataPoints_) {
-    samplingE = keyVal.first;  // move samplingE up
-    // check if went under the sampling energy
-    //  the map is sorted by key, so we can be done right after E0 goes under
-    //  samplingE
-    if (incident_energy < samplingE) break;
-  }
-  // now samplingE is the closest energy above E0 or the maximum energy imported
-  // from mad graph
+void G4DarkBreMModel::MakeForwardIndex(double lepton_mass) {
+  std::shared_ptr<ForwardIndex> index{std::make_shared<ForwardIndex>()};
+  index->lepton_mass = lepton_mass;
+  index->bins.reset(new OnceValue<ForwardBin>[library_->numEnergies()]);
+  forward_index_ = index;
+}
 
-  // Need to loop around if we hit the end, in case our random
-  // starting position happens to be late enough in the file
-  if (currentDataPoints_.at(samplingE) >= madGraphData_.at(samplingE).size()) {
-    currentDataPoints_[samplingE] = 0;
-  }
+const G4DarkBreMModel::ForwardBin& G4DarkBreMModel::GetForwardBin(std::size_t i_energy) const {
+  OnceValue<ForwardBin>& once{forward_index_->bins[i_energy]};
+  const ForwardBin* built{once.get()};
+  if (built) return *built;
+  const double lepton_mass{forward_index_->lepton_mass};
+  return once.getOrCompute([&]() {
+    const std::size_t n_events = library_->numEvents(i_energy);
+    const double* recoil_e = library_->column(EventLibrary::RecoilE, i_energy);
+    const double* recoil_px = library_->column(EventLibrary::RecoilPx, i_energy);
+    const double* recoil_py = library_->column(EventLibrary::RecoilPy, i_energy);
+    std::vector<double> min_ke_ratio(n_events);
+    for (std::size_t i{0}; i < n_events; i++) {
+      double ke_needed = std::sqrt(recoil_px[i]*recoil_px[i] + recoil_py[i]*recoil_py[i]
+                                   + lepton_mass*lepton_mass) - lepton_mass;
+      double ke = recoil_e[i] - lepton_mass;
+      if (ke_needed <= 0.) min_ke_ratio[i] = 0.;
+      else if (ke <= 0.) min_ke_ratio[i] = std::numeric_limits<double>::infinity();
+      else min_ke_ratio[i] = ke_needed / ke;
+    }
 
-  // increment the current index _after_ getting its entry from
-  // the in-memory library
-  return madGraphData_.at(samplingE).at(currentDataPoints_[samplingE]++);
+    // stable so that events with the same ratio keep their library order
+    ForwardBin bin;
+    bin.event.resize(n_events);
+    for (std::size_t i{0}; i < n_events; i++) bin.event[i] = i;
+    std::stable_sort(bin.event.begin(), bin.event.end(),
+        [&](std::uint32_t lhs, std::uint32_t rhs) {
+          return min_ke_ratio[lhs] < min_ke_ratio[rhs];
+        });
+    bin.min_ke_ratio.resize(n_events);
+    for (std::size_t i{0}; i < n_events; i++) bin.min_ke_ratio[i] = min_ke_ratio[bin.event[i]];
+    return bin;
+  });
 }
 
 }  // namespace g4db
-
@@ -11,9 +11,11 @@
 #include "G4MuonMinus.hh"     //for muon definition
 #include "G4MuonPlus.hh"      //for muon definition
 #include "G4EventManager.hh"  //for EventID number
-#include "G4ProcessTable.hh"  //for deactivating dark brem process
+#include "G4ProcessManager.hh" //for registering the process
 #include "G4ProcessType.hh"   //for type of process
-#include "G4RunManager.hh"    //for VerboseLevel
+#include "G4Run.hh"           //for RunID number
+#include "G4RunManager.hh"    //for RunID number
+#include "G4Material.hh"      //for tables of cross sections
 
 #include "G4DarkBreM/G4APrime.h"
 
@@ -26,7 +28,8 @@ G4DarkBremsstrahlung::G4DarkBremsstrahlung(
     : G4VDiscreteProcess(G4DarkBremsstrahlung::PROCESS_NAME,
                          fElectromagnetic),
       only_one_per_event_{only_one_per_event},
-      global_bias_{global_bias}, cache_xsec_{cache_xsec}, model_{the_model} {
+      global_bias_{global_bias}, cache_xsec_{cache_xsec}, model_{the_model},
+      min_kinetic_energy_{the_model->GetMinimumKineticEnergy()} {
   /**
    * @note we need to pretend to be an electromagnetic process 
    * so that the biasing framework can recognize us.
@@ -98,13 +101,29 @@ void G4DarkBremsstrahlung::PrintInfo() {
     << " Muons              : " << model_->DarkBremOffMuons() << "\n"
     << " Only One Per Event : " << only_one_per_event_ << "\n"
     << " Global Bias        : " << global_bias_ << "\n"
-    << " Cache Xsec         : " << cache_xsec_
+    << " Cache Xsec         : " << cache_xsec_ << "\n"
+    << " Material Tables    : " << use_material_tables_
     << G4endl;
   model_->PrintInfo();
+  if (g4db::instrumentation::ENABLED) PrintCounters();
+}
+
+void G4DarkBremsstrahlung::PrintCounters() const {
+  G4cout
+    << " Dark Brem Counters" << "\n"
+    << "   GetMeanFreePath  : " << n_mean_free_path_calls_.get() << "\n"
+    << "     Fast Path      : " << n_fast_path_steps_ << "\n"
+    << "   Xsec Cache Hits  : " << element_xsec_cache_.numHits() << "\n"
+    << "   Xsec Cache Misses: " << element_xsec_cache_.numMisses() << "\n"
+    << "   PostStepDoIt     : " << n_post_step_calls_.get()
+    << G4endl;
+  model_->PrintCounters();
 }
 
 G4VParticleChange* G4DarkBremsstrahlung::PostStepDoIt(const G4Track& track,
                                                        const G4Step& step) {
+  n_post_step_calls_.add();
+
   // Debugging Purposes: Check if track we get is the configured lepton
   if (not IsApplicable(*track.GetParticleDefinition()))
     throw std::runtime_error("Dark brem process received a track that isn't applicable."); 
@@ -117,30 +136,16 @@ G4VParticleChange* G4DarkBremsstrahlung::PostStepDoIt(const G4Track& track,
 
   if (only_one_per_event_) {
     /**
-     * If configured to do so, we deactivate the process after one dark brem.
-     * If this is in the stepping action instead, more than one brem can occur 
-     * within each step. 
-     *
-     * @note In order to use this feature, one must re-activate the DB process
-     * at the end of each event. This could be done in RunManager::TerminateOneEvent
-     * or G4UserEventAction::EndOfEventAction.
+     * If configured to do so, we disable the process for the rest of the event
+     * after one dark brem. If this is in the stepping action instead, more than
+     * one brem can occur within each step.
      *
-     * Both biased and unbiased process could be in the run (but not at the same time),
-     * so we turn off both while silencing the warnings from the process table.
-     * Reactivating the process is essentially the same code as here except using
-     * `true` intead of `false` in SetProcessActivation.
+     * GetMeanFreePath checks this flag, so the process does not need to be
+     * found in the process table and deactivated. StartTracking enables
+     * the process again once a track from a new event starts.
      */
-    if (GetVerboseLevel() > 2) G4cout << "Deactivating dark brem process." << G4endl;
-    std::vector<G4String> db_process_name_options = {
-        "biasWrapper(" + PROCESS_NAME + ")", PROCESS_NAME};
-    G4ProcessManager* pman = track.GetDefinition()->GetProcessManager();
-    for (int i_proc{0}; i_proc < pman->GetProcessList()->size(); i_proc++) {
-      G4VProcess* p{(*(pman->GetProcessList()))[i_proc]};
-      if (p->GetProcessName().contains(PROCESS_NAME)) {
-        pman->SetProcessActivation(p, false);
-        break;
-      }
-    }
+    if (GetVerboseLevel() > 2) G4cout << "Disabling dark brem for the rest of the event." << G4endl;
+    brem_this_event_ = true;
   }
 
   if (GetVerboseLevel() > 2) G4cout << "Initializing track" << G4endl;
@@ -158,30 +163,145 @@ G4VParticleChange* G4DarkBremsstrahlung::PostStepDoIt(const G4Track& track,
   return G4VDiscreteProcess::PostStepDoIt(track, step);
 }
 
+void G4DarkBremsstrahlung::UseMaterialTables(G4double min_energy, G4double max_energy,
+                                             std::size_t n_bins) {
+  if (min_energy <= 0. or max_energy <= min_energy or n_bins == 0) {
+    throw std::runtime_error("Material tables require 0 < min_energy < max_energy and at least one bin.");
+  }
+  use_material_tables_ = true;
+  table_min_energy_ = min_energy;
+  table_max_energy_ = max_energy;
+  table_n_bins_ = n_bins;
+}
+
+void G4DarkBremsstrahlung::InterpolateCache(G4double min_energy, G4double max_energy,
+                                            double tolerance) {
+  cache_xsec_ = true;
+  element_xsec_cache_ = g4db::ElementXsecCache(model_);
+  element_xsec_cache_.interpolate(min_energy, max_energy, tolerance);
+}
+
+void G4DarkBremsstrahlung::LoadXsecCache(const std::string& path) {
+  if (not cache_xsec_) {
+    cache_xsec_ = true;
+    element_xsec_cache_ = g4db::ElementXsecCache(model_);
+  }
+  element_xsec_cache_.load(path);
+  if (GetVerboseLevel() > 0) {
+    G4cout << "[ G4DarkBremsstrahlung ] : loaded cross section cache from "
+      << path << G4endl;
+  }
+}
+
+void G4DarkBremsstrahlung::BuildPhysicsTable(const G4ParticleDefinition& p) {
+  if (not IsApplicable(p)) return;
+
+  if (cache_xsec_ and element_xsec_cache_.interpolating()) {
+    if (GetVerboseLevel() > 0) {
+      G4cout << "[ G4DarkBremsstrahlung ] : building cross section grids for "
+        << G4Element::GetNumberOfElements() << " elements" << G4endl;
+    }
+    for (const G4Element* element : *G4Element::GetElementTable()) {
+      element_xsec_cache_.prepare(element->GetA() / (g / mole), element->GetZ());
+    }
+  }
+
+  if (not use_material_tables_) return;
+
+  if (GetVerboseLevel() > 0) {
+    G4cout << "[ G4DarkBremsstrahlung ] : building cross section tables for "
+      << G4Material::GetNumberOfMaterials() << " materials" << G4endl;
+  }
+
+  /*
+   * All of the tables share the same energy grid, so the cross section
+   * of an element at each energy of the grid only needs to be calculated
+   * once even if the element is in several materials.
+   */
+  std::map<std::size_t, std::vector<G4double>> element_xsecs;
+  material_tables_.clear();
+  for (const G4Material* material : *G4Material::GetMaterialTable()) {
+    std::unique_ptr<G4PhysicsLogVector> table{
+      new G4PhysicsLogVector(table_min_energy_, table_max_energy_, table_n_bins_)};
+    std::vector<G4double> sigma(table->GetVectorLength(), 0.);
+    const G4ElementVector* theElementVector = material->GetElementVector();
+    const G4double* NbOfAtomsPerVolume = material->GetVecNbOfAtomsPerVolume();
+    for (size_t i = 0; i < material->GetNumberOfElements(); i++) {
+      const G4Element* element = (*theElementVector)[i];
+      std::vector<G4double>& element_xsec = element_xsecs[element->GetIndex()];
+      if (element_xsec.empty()) {
+        G4double AtomicZ = element->GetZ();
+        G4double AtomicA = element->GetA() / (g / mole);
+        for (std::size_t i_bin{0}; i_bin < sigma.size(); i_bin++) {
+          element_xsec.push_back(
+              model_->ComputeCrossSectionPerAtom(table->Energy(i_bin), AtomicA, AtomicZ));
+        }
+      }
+      for (std::size_t i_bin{0}; i_bin < sigma.size(); i_bin++) {
+        sigma[i_bin] += NbOfAtomsPerVolume[i] * element_xsec[i_bin];
+      }
+    }
+    for (std::size_t i_bin{0}; i_bin < sigma.size(); i_bin++) {
+      table->PutValue(i_bin, sigma[i_bin]);
+    }
+    material_tables_.push_back(std::move(table));
+  }
+}
+
+void G4DarkBremsstrahlung::StartTracking(G4Track* track) {
+  G4VDiscreteProcess::StartTracking(track);
+  if (not only_one_per_event_) return;
+  /*
+   * event IDs start over at zero for each run,
+   * so we need both to tell if this is a new event
+   */
+  G4int event_id = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
+  G4int run_id = G4RunManager::GetRunManager()->GetCurrentRun()->GetRunID();
+  if (event_id != event_id_ or run_id != run_id_) {
+    event_id_ = event_id;
+    run_id_ = run_id;
+    brem_this_event_ = false;
+  }
+}
+
 G4double G4DarkBremsstrahlung::GetMeanFreePath(const G4Track& track, G4double,
                                                 G4ForceCondition*) {
-  // won't happen if it isn't applicable
-  if (not IsApplicable(*track.GetParticleDefinition())) return DBL_MAX;
+  n_mean_free_path_calls_.add();
+
+  // only one dark brem per event if configured
+  if (brem_this_event_) return DBL_MAX;
 
+  // won't happen if the lepton doesn't have enough energy or it isn't applicable
   G4double energy = track.GetDynamicParticle()->GetKineticEnergy();
+  if (energy < min_kinetic_energy_ or not IsApplicable(*track.GetParticleDefinition())) {
+    n_fast_path_steps_++;
+    return DBL_MAX;
+  }
+
   G4double SIGMA = 0;
   G4Material* materialWeAreIn = track.GetMaterial();
-  const G4ElementVector* theElementVector = materialWeAreIn->GetElementVector();
-  const G4double* NbOfAtomsPerVolume = materialWeAreIn->GetVecNbOfAtomsPerVolume();
-  
-  for (size_t i = 0; i < materialWeAreIn->GetNumberOfElements(); i++) {
-    G4double AtomicZ = (*theElementVector)[i]->GetZ();
-    G4double AtomicA = (*theElementVector)[i]->GetA() / (g / mole);
-  
-    G4double element_xsec;
-  
-    if (cache_xsec_)
-      element_xsec = element_xsec_cache_.get(energy, AtomicA, AtomicZ);
-    else
-      element_xsec =
-          model_->ComputeCrossSectionPerAtom(energy, AtomicA, AtomicZ);
-  
-    SIGMA += NbOfAtomsPerVolume[i] * element_xsec;
+  std::size_t material_index = materialWeAreIn->GetIndex();
+  if (material_index < material_tables_.size()
+      and energy >= table_min_energy_ and energy <= table_max_energy_) {
+    SIGMA = material_tables_[material_index]->Value(energy);
+  } else {
+    const G4ElementVector* theElementVector = materialWeAreIn->GetElementVector();
+    const G4double* NbOfAtomsPerVolume = materialWeAreIn->GetVecNbOfAtomsPerVolume();
+    
+    for (size_t i = 0; i < materialWeAreIn->GetNumberOfElements(); i++) {
+      G4double AtomicZ = (*theElementVector)[i]->GetZ();
+      G4double AtomicA = (*theElementVector)[i]->GetA() / (g / mole);
+    
+      G4double element_xsec;
+    
+      if (cache_xsec_)
+        element_xsec = element_xsec_cache_.get(energy, AtomicA, AtomicZ);
+      else
+        element_xsec =
+            model_->ComputeCrossSectionPerAtom(energy, AtomicA, AtomicZ);
+    
+      SIGMA += NbOfAtomsPerVolume[i] * element_xsec;
+    }
   }
   SIGMA *= global_bias_;
   if (GetVerboseLevel() > 3) {
@@ -1,6 +1,16 @@
 #include <dirent.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
-#include <sstream>
+#include <thread>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
 
 #include <boost/iostreams/operations.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
@@ -11,6 +21,7 @@
 #include <boost/iostreams/close.hpp>
 
 #include "G4DarkBreM/ParseLibrary.h"
+#include "G4DarkBreM/BinaryLibrary.h"
 
 namespace g4db {
 
@@ -34,6 +45,197 @@ bool hasEnding(const std::string& str, const std::string& end) {
  */
 namespace parse {
 
+/**
+ * Read lines from an input stream without copying them into strings
+ *
+ * The stream is read in large blocks into a single buffer that is
+ * re-used for the whole stream. Each line is handed out as a pair of
+ * pointers into this buffer, so reading a line does not allocate
+ * and does not copy. The buffer only grows if a single line is longer
+ * than the buffer.
+ *
+ * The pointers for a line are only valid until the next call to next.
+ * The character after the end of each line is always a newline or
+ * a null character.
+ */
+class LineReader {
+ public:
+  /**
+   * Wrap the input stream
+   *
+   * @param[in] reader input stream to read lines from
+   * @param[in] block_size number of bytes to read from the stream at once
+   */
+  LineReader(std::istream& reader, std::size_t block_size = 1 << 20)
+    : reader_{reader}, buffer_(block_size), begin_{0}, end_{0} {}
+
+  /**
+   * Get the next line from the stream
+   *
+   * The newline character is not included in the line.
+   *
+   * @param[out] line_begin pointer to the first character of the line
+   * @param[out] line_end pointer to one past the last character of the line
+   * @return false if there are no more lines in the stream
+   */
+  bool next(const char*& line_begin, const char*& line_end) {
+    std::size_t searched{begin_};
+    while (true) {
+      const char* nl = static_cast<const char*>(
+          std::memchr(buffer_.data() + searched, '\n', end_ - searched));
+      if (nl) {
+        line_begin = buffer_.data() + begin_;
+        line_end = nl;
+        begin_ = nl - buffer_.data() + 1;
+        return true;
+      }
+      std::size_t partial = end_ - begin_;
+      if (not fill()) {
+        // last line in the stream may not end in a newline
+        if (begin_ == end_) return false;
+        line_begin = buffer_.data() + begin_;
+        line_end = buffer_.data() + end_;
+        begin_ = end_;
+        return true;
+      }
+      // fill moved the partial line to the front of the buffer
+      // and we already know it does not have a newline
+      searched = partial;
+    }
+  }
+
+  /// number of bytes read from the stream so far
+  std::size_t bytesRead() const { return bytes_read_; }
+
+ private:
+  /**
+   * Read another block from the stream
+   *
+   * The partial line at the end of the buffer is moved to the front
+   * and the buffer is grown if the partial line fills it.
+   *
+   * @return false if no more characters could be read
+   */
+  bool fill() {
+    std::size_t partial = end_ - begin_;
+    if (begin_ > 0) std::memmove(buffer_.data(), buffer_.data() + begin_, partial);
+    begin_ = 0;
+    end_ = partial;
+    // keep one character at the end for the null terminator
+    if (end_+1 >= buffer_.size()) buffer_.resize(2*buffer_.size());
+    reader_.read(buffer_.data() + end_, buffer_.size() - end_ - 1);
+    std::size_t n_read = reader_.gcount();
+    end_ += n_read;
+    buffer_[end_] = '\0';
+    bytes_read_ += n_read;
+    return n_read > 0;
+  }
+
+ private:
+  /// stream we are reading
+  std::istream& reader_;
+  /// buffer holding the current block
+  std::vector<char> buffer_;
+  /// position of the beginning of the next line in the buffer
+  std::size_t begin_;
+  /// position of one past the last valid character in the buffer
+  std::size_t end_;
+  /// total bytes read
+  std::size_t bytes_read_{0};
+};  // LineReader
+
+/**
+ * Parse an integer from the front of the input range
+ *
+ * Leading spaces and tabs are skipped and the integer must be
+ * followed by the end of the range, a space, a tab, or a carriage return.
+ *
+ * @param[in,out] pos position to start parsing, moved past the parsed integer
+ * @param[in] end end of the range
+ * @param[out] val value that was parsed
+ * @return true if an integer was parsed
+ */
+bool parseInt(const char*& pos, const char* end, int& val) {
+  while (pos != end and (*pos == ' ' or *pos == '\t')) ++pos;
+  const char* start = pos;
+  bool negative{false};
+  if (pos != end and (*pos == '-' or *pos == '+')) negative = (*pos++ == '-');
+  const char* digits = pos;
+  int v{0};
+  while (pos != end and *pos >= '0' and *pos <= '9') v = 10*v + (*pos++ - '0');
+  if (pos == digits or (pos != end and *pos != ' ' and *pos != '\t' and *pos != '\r')) {
+    pos = start;
+    return false;
+  }
+  val = negative ? -v : v;
+  return true;
+}
+
+/**
+ * Parse a floating point number from the front of the input range
+ *
+ * Leading spaces and tabs are skipped and the number must be
+ * followed by the end of the range, a space, a tab, a carriage return,
+ * or the input delimiter.
+ *
+ * If available, we use std::from_chars which is independent of the
+ * locale and does not need to look past the end of the range.
+ * Otherwise, we fall back to std::strtod which is safe since the
+ * LineReader always has a newline or null character after each line.
+ *
+ * @param[in,out] pos position to start parsing, moved past the parsed number
+ * @param[in] end end of the range
+ * @param[out] val value that was parsed
+ * @param[in] delim extra character allowed to end the number
+ * @return true if a number was parsed
+ */
+bool parseDouble(const char*& pos, const char* end, double& val, char delim = ' ') {
+  while (pos != end and (*pos == ' ' or *pos == '\t')) ++pos;
+  // strtod would skip over other whitespace (including newlines)
+  if (pos == end or std::isspace(static_cast<unsigned char>(*pos))) return false;
+  const char* stop;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  // from_chars does not accept a leading '+'
+  const char* start = (*pos == '+') ? pos+1 : pos;
+  auto res = std::from_chars(start, end, val);
+  if (res.ec != std::errc()) return false;
+  stop = res.ptr;
+#else
+  char* strtod_stop;
+  val = std::strtod(pos, &strtod_stop);
+  stop = strtod_stop;
+  if (stop == pos or stop > end) return false;
+#endif
+  if (stop != end and *stop != ' ' and *stop != '\t' and *stop != '\r' and *stop != delim) return false;
+  pos = stop;
+  return true;
+}
+
+/**
+ * Parse an LHE particle line
+ *
+ * The particle line has the particle ID, its state, four integers
+ * we skip, and then the four-momentum and mass.
+ *
+ * @param[in] pos beginning of line
+ * @param[in] end end of line
+ * @param[out] ptype particle ID
+ * @param[out] state particle state
+ * @param[out] p four-momentum (px, py, pz, E) followed by mass
+ * @return true if the line had all of these fields
+ */
+bool parseParticle(const char* pos, const char* end, int& ptype, int& state, double p[5]) {
+  int skip;
+  if (not parseInt(pos, end, ptype) or not parseInt(pos, end, state)) return false;
+  for (int i{0}; i < 4; i++) {
+    if (not parseInt(pos, end, skip)) return false;
+  }
+  for (int i{0}; i < 5; i++) {
+    if (not parseDouble(pos, end, p[i])) return false;
+  }
+  return true;
+}
+
 /**
  * Parse an LHE file from the input stream
  *
@@ -43,10 +245,8 @@ namespace parse {
  * ```
  *   lepton_id -1 <skip> <skip> <skip> <skip> px py pz E m
  *   <skip-line>
- *   <skip-line>
  *   lepton_id 1 <skip> <skip> <skip> <skip> px py pz E m
  *   <skip-line>
- *   <skip-line>
  *   aprime_id 1 <skip> <skip> <skip> <skip> px py pz E m
  * ```
  *
@@ -55,6 +255,10 @@ namespace parse {
  * is skipped and additional assumptions are made in order to increase the 
  * parsing speed.
  *
+ * The lines are scanned directly from the decompressed buffer using a
+ * LineReader and the fields are converted in place, so no memory is
+ * allocated per line.
+ *
  * The `lepton_id` is allowed to be _either_ 11 or 13 _everywhere_. No consistency
  * checking is done.
  *
@@ -68,44 +272,37 @@ namespace parse {
  * @param[in,out] lib dark brem event library to fill
  */
 void lhe(boost::iostreams::filtering_istream& reader, int aprime_lhe_id, std::map<double, std::vector<OutgoingKinematics>>& lib) {
-  std::string line;
-  while (std::getline(reader,line)) {
-    std::istringstream iss(line);
-    int ptype, state;
-    double skip, px, py, pz, E, M;
-    if (iss >> ptype >> state >> skip >> skip >> skip >> skip 
-            >> px >> py >> pz >> E >> M) {
-      if ((ptype == 11 or ptype == 13) && (state == -1)) {
-        double incident_energy = E;
-        double e_px, e_py, e_pz, a_px, a_py, a_pz, e_E, a_E, e_M, a_M;
-        for (int i = 0; i < 2; i++) {
-          std::getline(reader,line);
-        }
-        std::istringstream jss(line);
-        jss >> ptype >> state >> skip >> skip >> skip >> skip 
-            >> e_px >> e_py >> e_pz >> e_E >> e_M;
-        if ((ptype == 11 or ptype == 13) && (state == 1)) {  // Find a final state lepton
-          for (int i = 0; i < 2; i++) {
-            std::getline(reader,line);
-          }
-          std::istringstream kss(line);
-          kss >> ptype >> state >> skip >> skip >> skip >> skip 
-              >> a_px >> a_py >> a_pz >> a_E >> a_M;
-          if (ptype == aprime_lhe_id and state == 1) {
-            OutgoingKinematics evnt;
-            double cmpx = a_px + e_px;
-            double cmpy = a_py + e_py;
-            double cmpz = a_pz + e_pz;
-            double cmE = a_E + e_E;
-            evnt.lepton = CLHEP::HepLorentzVector(e_px, e_py, e_pz, e_E);
-            evnt.centerMomentum = CLHEP::HepLorentzVector(cmpx, cmpy, cmpz, cmE);
-            evnt.E = incident_energy;
-            lib[incident_energy].push_back(evnt);
-          }  // get a prime kinematics
-        }    // check for final state
-      }      // check for particle type and state
-    }        // able to get momentum/energy numbers
-  }          // while getting lines
+  LineReader lines(reader);
+  const char *begin, *end;
+  int ptype, state;
+  double incident[5], recoil[5], aprime[5];
+  // cache the vector we are filling since events are grouped by incident energy
+  double current_energy{-1};
+  std::vector<OutgoingKinematics>* current_events{nullptr};
+  while (lines.next(begin, end)) {
+    if (not parseParticle(begin, end, ptype, state, incident)) continue;
+    if ((ptype != 11 and ptype != 13) or state != -1) continue;
+    // skip a line and then look for a final state lepton
+    if (not lines.next(begin, end) or not lines.next(begin, end)) break;
+    if (not parseParticle(begin, end, ptype, state, recoil)) continue;
+    if ((ptype != 11 and ptype != 13) or state != 1) continue;
+    // skip a line and then look for the A'
+    if (not lines.next(begin, end) or not lines.next(begin, end)) break;
+    if (not parseParticle(begin, end, ptype, state, aprime)) continue;
+    if (ptype != aprime_lhe_id or state != 1) continue;
+
+    OutgoingKinematics evnt;
+    evnt.lepton = CLHEP::HepLorentzVector(recoil[0], recoil[1], recoil[2], recoil[3]);
+    evnt.centerMomentum = CLHEP::HepLorentzVector(
+        aprime[0] + recoil[0], aprime[1] + recoil[1],
+        aprime[2] + recoil[2], aprime[3] + recoil[3]);
+    evnt.E = incident[3];
+    if (current_events == nullptr or current_energy != evnt.E) {
+      current_energy = evnt.E;
+      current_events = &lib[current_energy];
+    }
+    current_events->push_back(evnt);
+  }
 }
 
 /**
@@ -115,7 +312,8 @@ void lhe(boost::iostreams::filtering_istream& reader, int aprime_lhe_id, std::ma
  * names the columns. These column names have no requirements
  * (besides the existence of this line).
  *
- * The CSV is required to have 9 columns on all non-empty lines of the file.
+ * The CSV is required to have 9 columns on all non-empty lines of the file
+ * and parsing stops at the first empty line.
  * The 9 columns of the CSV all are in MeV and _in order_ are
  * 1. The incident lepton energy
  * 2. The total energy of the recoil
@@ -127,42 +325,79 @@ void lhe(boost::iostreams::filtering_istream& reader, int aprime_lhe_id, std::ma
  * 8. The y-component of the A' momentum
  * 9. The z-component of the A' momentum
  *
+ * The rows are scanned directly from the decompressed buffer using a
+ * LineReader and each row is parsed straight into the kinematics without
+ * any intermediate allocation.
+ *
  * @note If developing this function, make sure to update dumpLibrary
  * so that they can be used in conjuction.
  *
+ * @throws std::runtime_error if a row does not have exactly 9 numeric columns
  * @param[in] reader input stream reading the file
  * @param[in,out] lib dark brem event library to fill
  */
 void csv(boost::iostreams::filtering_istream& reader, std::map<double, std::vector<OutgoingKinematics>>& lib) {
-  std::string line;
+  LineReader lines(reader);
+  const char *begin, *end;
   // skip the header line
-  if (not std::getline(reader, line)) {
+  if (not lines.next(begin, end)) {
     throw std::runtime_error("Empty CSV file.");
   }
+  /*
+   * The row has a fixed number of columns, so we parse them directly into
+   * a fixed-size array, requiring a comma between each column and the
+   * end of the line after the last one.
+   */
+  static const int n_columns{9};
+  double vals[n_columns];
+  double current_energy{-1};
+  std::vector<OutgoingKinematics>* current_events{nullptr};
+  std::size_t line_number{1};
   // read in all non-empty lines
-  while (std::getline(reader, line) and not line.empty()) {
-    std::istringstream lss{line};
-    std::vector<double> vals;
-    std::string cell;
-    while (std::getline(lss,cell,',')) {
-      vals.push_back(std::stod(cell));
+  while (lines.next(begin, end)) {
+    line_number++;
+    if (begin != end and *(end-1) == '\r') --end;
+    if (begin == end) break;
+    const char* pos = begin;
+    int i_col{0};
+    for (; i_col < n_columns; i_col++) {
+      if (i_col > 0) {
+        if (pos == end or *pos != ',') break;
+        ++pos;
+      }
+      if (not parseDouble(pos, end, vals[i_col], ',')) break;
     }
-    if (not lss and cell.empty()) vals.push_back(-9999);
-    if (vals.size() != 9) {
-      throw std::runtime_error("Malformed row in CSV file: not exactly 9 columns");
+    while (pos != end and (*pos == ' ' or *pos == '\t')) ++pos;
+    if (i_col != n_columns or pos != end) {
+      throw std::runtime_error("Malformed row in CSV file: not exactly 9 columns (line "
+          +std::to_string(line_number)+")");
     }
     OutgoingKinematics ok;
     ok.E = vals[0];
     ok.lepton = CLHEP::HepLorentzVector(vals[2], vals[3], vals[4], vals[1]);
     ok.centerMomentum = CLHEP::HepLorentzVector(vals[6], vals[7], vals[8], vals[5]);
-    lib[ok.E].push_back(ok);
+    if (current_events == nullptr or current_energy != ok.E) {
+      current_energy = ok.E;
+      current_events = &lib[current_energy];
+    }
+    current_events->push_back(ok);
   }
 }
 
 }  // namspace parser
 
-void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, std::vector<OutgoingKinematics>>& lib) {
-  if (hasEnding(path, ".csv") or hasEnding(path, ".csv.gz") or hasEnding(path, ".lhe") or hasEnding(path, ".lhe.gz")) {
+void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, std::vector<OutgoingKinematics>>& lib,
+    unsigned int n_threads) {
+  if (binary::isBinaryLibrary(path)) {
+    /**
+     * If the input path has the binary library extension, we map
+     * it into memory and copy its events into the library.
+     *
+     * @see binary::MappedLibrary for sampling from a binary library
+     * without copying it
+     */
+    binary::MappedLibrary(path).fill(lib);
+  } else if (hasEnding(path, ".csv") or hasEnding(path, ".csv.gz") or hasEnding(path, ".lhe") or hasEnding(path, ".lhe.gz")) {
     /**
      * If the input path has one of the four file extensions below,
      * we assume it is a file to be parsed into the library.
@@ -191,6 +426,7 @@ void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, s
      *
      * @note We _do not_ recursively enter subdirectories.
      */
+    std::vector<std::string> files;
     DIR *dir;            // handle to opened directory
     struct dirent *ent;  // handle to entry inside directory
     if ((dir = opendir(path.c_str())) != NULL) {
@@ -199,12 +435,7 @@ void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, s
         std::string fp = path + '/' + std::string(ent->d_name);
         if (hasEnding(fp,".lhe") or hasEnding(fp, ".lhe.gz")
             or hasEnding(fp,".csv") or hasEnding(fp, ".csv.gz")) {
-          /**
-           * If any of the directory entries has one of the acceptable
-           * extensions, we recursively call this function on that 
-           * file path so that it can be parsed into the library.
-           */
-          parseLibrary(fp, aprime_lhe_id, lib);
+          files.push_back(fp);
         }
       }
       closedir(dir);
@@ -215,6 +446,63 @@ void parseLibrary(const std::string& path, int aprime_lhe_id, std::map<double, s
        */
       throw std::runtime_error("Unable to open '"+path+"' as a directory.");
     }
+
+    /**
+     * The order of entries returned by `readdir` is unspecified, so we
+     * sort the files that have one of the acceptable extensions by name.
+     * The events in the resulting library are in the order of these
+     * sorted file names, making the library deterministic.
+     */
+    std::sort(files.begin(), files.end());
+
+    /**
+     * Each file is parsed into its own partial library by recursively
+     * calling this function on that file path. The files are distributed
+     * across up to `n_threads` threads, each thread taking the next
+     * unparsed file when it finishes its current one.
+     *
+     * The partial libraries are merged into the output library in the
+     * sorted order of the files, so the result does not depend on
+     * how many threads were used or which thread parsed which file.
+     * If parsing any of the files throws an exception, the first one
+     * (in file order) is re-thrown after all of the threads finish.
+     */
+    std::vector<std::map<double, std::vector<OutgoingKinematics>>> partials(files.size());
+    std::vector<std::exception_ptr> errors(files.size());
+    std::atomic<std::size_t> next_file{0};
+    auto worker = [&]() {
+      for (std::size_t i_file = next_file++; i_file < files.size(); i_file = next_file++) {
+        try {
+          parseLibrary(files[i_file], aprime_lhe_id, partials[i_file]);
+        } catch (...) {
+          errors[i_file] = std::current_exception();
+        }
+      }
+    };
+
+    std::size_t n_workers = std::min<std::size_t>(std::max(n_threads, 1u), files.size());
+    if (n_workers <= 1) {
+      worker();
+    } else {
+      std::vector<std::thread> threads;
+      for (std::size_t i_thread{0}; i_thread < n_workers; i_thread++) {
+        threads.emplace_back(worker);
+      }
+      for (auto& thread : threads) thread.join();
+    }
+
+    for (const auto& error : errors) {
+      if (error) std::rethrow_exception(error);
+    }
+
+    for (auto& partial : partials) {
+      for (auto& partial_entry : partial) {
+        auto& events = lib[partial_entry.first];
+        events.insert(events.end(), partial_entry.second.begin(), partial_entry.second.end());
+      }
+      // release this partial library now that it has been merged
+      partial.clear();
+    }
   }
 }
 